@@ -1,7 +1,10 @@
 #include "dev/cpio.h"
 #include "config.h"
 #include "log.h"
+#include "minmax.h"
+#include "mm.h"
 #include "string.h"
+#include "test.h"
 #include "uart.h"
 
 #ifdef CFG_LOG_CPIO
@@ -29,11 +32,107 @@ int cpioLs(void *archive) {
   return 0;
 }
 
+// Open addressing, at most half full
+struct cpioIndexEntry {
+  uint32_t hash;
+  const char *filename; // NULL for an empty slot
+  void *data;
+  unsigned long size;
+};
+
+static struct cpioIndex {
+  void *archive;
+  uint32_t mask; // number of slots - 1
+  struct cpioIndexEntry *slots;
+} fileIndex = {.archive = NULL};
+
+// FNV-1a
+static uint32_t pathHash(const char *s) {
+  uint32_t h = 2166136261u;
+  for (; *s; s++) {
+    h = (h ^ (uint8_t)*s) * 16777619u;
+  }
+  return h;
+}
+
+int cpioBuildIndex(void *archive) {
+  CpioNewcHeader *header, *next;
+  const char *filename;
+  void *data;
+  uint64_t filesize;
+  uint32_t numFiles = 0, nslots = 4, h;
+  int err;
+
+  // Same walk as cpioArchiveSize, entries end at the trailer
+  for (header = archive;; header = next, numFiles++) {
+    err = cpioParseHeader(header, &filename, NULL, NULL, &data, &next);
+    if (err == 1) {
+      return -1;
+    } else if (err == -1) {
+      break;
+    }
+  }
+  if (numFiles == 0) {
+    return -1;
+  }
+  while (nslots < numFiles * 2) {
+    nslots <<= 1;
+  }
+  if (fileIndex.slots != NULL) {
+    kfree(fileIndex.slots);
+  }
+  fileIndex.slots = kalloc(sizeof(struct cpioIndexEntry) * nslots);
+  fileIndex.mask = nslots - 1;
+  for (uint32_t i = 0; i < nslots; i++) {
+    fileIndex.slots[i].filename = NULL;
+  }
+
+  for (header = archive;; header = next) {
+    if (cpioParseHeader(header, &filename, &filesize, NULL, &data, &next)) {
+      break;
+    }
+    h = pathHash(filename);
+    for (uint32_t i = h;; i++) {
+      struct cpioIndexEntry *e = &fileIndex.slots[i & fileIndex.mask];
+      if (e->filename == NULL) {
+        *e = (struct cpioIndexEntry){h, filename, data, filesize};
+        break;
+      }
+      // Keep the first entry of a duplicated name, as a scan would find
+      if (e->hash == h && strcmp(e->filename, filename) == 0) {
+        break;
+      }
+    }
+  }
+  fileIndex.archive = archive;
+  log_println("[cpio] indexed %d entries in %d slots", numFiles, nslots);
+  return 0;
+}
+
+static void *indexGetFile(const char *name, unsigned long *size) {
+  uint32_t h = pathHash(name);
+  for (uint32_t i = h;; i++) {
+    struct cpioIndexEntry *e = &fileIndex.slots[i & fileIndex.mask];
+    if (e->filename == NULL) {
+      return NULL;
+    }
+    if (e->hash == h && strcmp(e->filename, name) == 0) {
+      if (size != NULL) {
+        *size = e->size;
+      }
+      return e->data;
+    }
+  }
+}
+
 void *cpioGetFile(void *archive, const char *name, unsigned long *size) {
   CpioNewcHeader *header, *next;
   const char *filename;
   void *fileContent;
   int err;
+  if (archive == fileIndex.archive) {
+    return indexGetFile(name, size);
+  }
   for (header = archive;; header = next) {
     err = cpioParseHeader(header, &filename, size, NULL, &fileContent, &next);
     if (err) {
@@ -46,6 +145,26 @@ void *cpioGetFile(void *archive, const char *name, unsigned long *size) {
   return NULL;
 }
 
+unsigned long cpioArchiveSize(void *archive) {
+  CpioNewcHeader *header, *next;
+  const char *filename;
+  void *data;
+  int err;
+  for (header = archive;; header = next) {
+    err = cpioParseHeader(header, &filename, NULL, NULL, &data, &next);
+    if (err == 1) {
+      return 0;
+    } else if (err == -1) {
+      break;
+    }
+  }
+  // Stopped at the trailer (or a broken header, which ends the archive too)
+  return _alignUp((uintptr_t)header + sizeof(CpioNewcHeader) +
+                      sizeof(CPIO_FOOTER_MAGIC),
+                  4) -
+         (uintptr_t)archive;
+}
+
 int cpioInfo(void *archive, CpioSummaryInfo *info) {
   CpioNewcHeader *header, *next;
   const char *filename;
@@ -109,6 +228,63 @@ int64_t _parseHexStr(const char *buf, int len) {
   return out;
 }
 
+#define SWAR_ONES 0x0101010101010101ULL
+#define SWAR_HIGH 0x8080808080808080ULL
+
+// Lets a char field be read by halfwords without breaking strict aliasing
+typedef uint16_t __attribute__((may_alias)) cpioHalf;
+
+/**
+ * Gather the 8 chars of a field into a word, the first char in the lowest
+ * byte (little endian). Fields are only 2-byte aligned (after the 6 byte
+ * magic) and unaligned loads fault while the MMU is off.
+ */
+static inline uint64_t _loadHex8(const cpioHalf *half) {
+  return (uint64_t)half[0] | (uint64_t)half[1] << 16 |
+         (uint64_t)half[2] << 32 | (uint64_t)half[3] << 48;
+}
+
+/**
+ * Parse 8 hex chars gathered by _loadHex8 into their value, all the bytes
+ * are handled at once in a general register. Bytes are kept below 0x80, so
+ * adding a constant to every byte never carries into the next one.
+ * return -1 if any char is not valid
+ */
+static inline int64_t _parseHex8(uint64_t x) {
+  uint64_t lower, digit, alpha;
+  if (x & SWAR_HIGH) {
+    return -1;
+  }
+  // Bit 7 of a byte is set by the add once it reaches the bound
+  lower = x | (0x20 * SWAR_ONES); // 'A'-'F' -> 'a'-'f'
+  digit = (x + (0x80 - '0') * SWAR_ONES) & ~(x + (0x80 - '9' - 1) * SWAR_ONES);
+  alpha = (lower + (0x80 - 'a') * SWAR_ONES) &
+          ~(lower + (0x80 - 'f' - 1) * SWAR_ONES);
+  if (((digit | alpha) & SWAR_HIGH) != SWAR_HIGH) {
+    return -1;
+  }
+  // Value is the low nibble, plus 9 for a letter
+  x = (x & (0x0f * SWAR_ONES)) + ((alpha & SWAR_HIGH) >> 7) * 9;
+  // Merge neighbouring digits, the first char is the most significant
+  x = ((x << 4) | (x >> 8)) & 0x00ff00ff00ff00ffULL;
+  x = ((x << 8) | (x >> 16)) & 0x0000ffff0000ffffULL;
+  x = ((x << 16) | (x >> 32)) & 0xffffffffULL;
+  return (int64_t)x;
+}
+
+int cpioParseHeaderFields(const CpioNewcHeader *header,
+                          uint32_t fields[CPIO_NEWC_FIELDS]) {
+  const cpioHalf *half = (const cpioHalf *)header->ino;
+  int64_t val;
+  for (int i = 0; i < CPIO_NEWC_FIELDS; i++, half += 4) {
+    if ((val = _parseHex8(_loadHex8(half))) == -1) {
+      return -1;
+    }
+    fields[i] = (uint32_t)val;
+  }
+  return 0;
+}
+
 /* Align 'n' up to the value 'align', which must be a power of two.
   Reference:
   https://github.com/SEL4PROJ/libcpio/blob/master/src/cpio.c
@@ -117,6 +293,63 @@ uintptr_t _alignUp(uintptr_t n, unsigned long align) {
   return (n + align - 1) & (~(align - 1));
 }
 
+void cpioStreamInit(CpioStream *s, size_t (*read)(void *, void *, size_t),
+                    void *ctx) {
+  s->read = read;
+  s->ctx = ctx;
+  s->offset = 0;
+  s->remain = 0;
+}
+
+// @retval 0 if all the bytes are pulled
+static int streamPull(CpioStream *s, void *buf, size_t len) {
+  size_t n = s->read(s->ctx, buf, len);
+  s->offset += n;
+  return n == len ? 0 : -1;
+}
+
+// Headers and data start at a multiple of 4 bytes
+static int streamAlign(CpioStream *s) {
+  return streamPull(s, NULL, _alignUp(s->offset, 4) - s->offset);
+}
+
+int cpioStreamNext(CpioStream *s, char *name, size_t nameMax,
+                   uint64_t *filesize, uint64_t *mode) {
+  CpioNewcHeader header __attribute__((aligned(4)));
+  uint32_t fields[CPIO_NEWC_FIELDS], namesize;
+
+  if (streamPull(s, NULL, s->remain) || streamAlign(s)) {
+    return -1;
+  }
+  s->remain = 0;
+  if (streamPull(s, &header, sizeof(CpioNewcHeader)) ||
+      strncmp(header.magic, CPIO_HEADER_MAGIC, 6) ||
+      cpioParseHeaderFields(&header, fields)) {
+    return -1;
+  }
+  namesize = fields[CPIO_FIELD_NAMESIZE];
+  if (namesize == 0 || namesize > nameMax ||
+      streamPull(s, name, namesize) || streamAlign(s)) {
+    return -1;
+  }
+  name[namesize - 1] = '\0';
+  if (strcmp(name, CPIO_FOOTER_MAGIC) == 0) {
+    return 1;
+  }
+  s->remain = fields[CPIO_FIELD_FILESIZE];
+  *filesize = fields[CPIO_FIELD_FILESIZE];
+  *mode = fields[CPIO_FIELD_MODE];
+  log_println("  [stream] found entry: %s, size:%d", name, (int)*filesize);
+  return 0;
+}
+
+size_t cpioStreamRead(CpioStream *s, void *buf, size_t len) {
+  size_t n = s->read(s->ctx, buf, min(len, s->remain));
+  s->offset += n;
+  s->remain -= n;
+  return n;
+}
+
 int cpioParseHeader(CpioNewcHeader *header, const char **filename,
                     uint64_t *_filesize, uint64_t *mode, void **data,
                     CpioNewcHeader **next) {
@@ -125,12 +358,14 @@ int cpioParseHeader(CpioNewcHeader *header, const char **filename,
     return 1;
   }
 
+  uint32_t fields[CPIO_NEWC_FIELDS];
   uint64_t filesize, namesize, fmode;
-  if (((filesize = _parseHexStr(header->filesize, 8)) == -1) ||
-      ((namesize = _parseHexStr(header->namesize, 8)) == -1) ||
-      ((fmode = _parseHexStr(header->mode, 8)) == -1)) {
+  if (cpioParseHeaderFields(header, fields) != 0) {
     return -1;
   }
+  filesize = fields[CPIO_FIELD_FILESIZE];
+  namesize = fields[CPIO_FIELD_NAMESIZE];
+  fmode = fields[CPIO_FIELD_MODE];
 
   log_println("  [parseHeader] found entry: size:%d, namesize:%d", filesize,
               namesize);
@@ -158,3 +393,111 @@ int cpioParseHeader(CpioNewcHeader *header, const char **filename,
   }
   return 0;
 }
+
+#ifdef CFG_RUN_DEV_CPIO_TEST
+// Agrees with the scalar parser for every byte at every position
+bool test_cpio_parse_hex() {
+  // Aligned as inside an archive
+  CpioNewcHeader header __attribute__((aligned(4)));
+  uint32_t fields[CPIO_NEWC_FIELDS];
+  char *field = header.ino, *all = (char *)&header + sizeof(header.magic);
+
+  memcpy(field, "0123abCD", 8);
+  assert(_parseHex8(_loadHex8((const cpioHalf *)field)) == 0x0123abcd);
+  memcpy(field, "FFFFFFFF", 8);
+  assert(_parseHex8(_loadHex8((const cpioHalf *)field)) == 0xffffffff);
+  for (int pos = 0; pos < 8; pos++) {
+    for (int c = 0; c < 256; c++) {
+      memcpy(field, "5a5A5a5A", 8);
+      field[pos] = (char)c;
+      assert(_parseHex8(_loadHex8((const cpioHalf *)field)) ==
+             _parseHexStr(field, 8));
+    }
+  }
+
+  for (int i = 0; i < CPIO_NEWC_FIELDS; i++) {
+    memcpy(all + i * 8, "0000000a", 8);
+    all[i * 8 + 6] = "0123456789abc"[i];
+  }
+  assert(cpioParseHeaderFields(&header, fields) == 0);
+  for (int i = 0; i < CPIO_NEWC_FIELDS; i++) {
+    assert(fields[i] == (uint32_t)(i * 16 + 10));
+  }
+  header.check[7] = 'g';
+  assert(cpioParseHeaderFields(&header, fields) == -1);
+  return true;
+}
+
+// Pull bytes out of an archive in memory
+static size_t memoryPull(void *ctx, void *buf, size_t len) {
+  const char **src = ctx;
+  if (buf != NULL) {
+    memcpy(buf, *src, len);
+  }
+  *src += len;
+  return len;
+}
+
+// Streaming through the initramfs gives the same entries as parsing in place
+bool test_cpio_stream() {
+  CpioNewcHeader *header, *next;
+  CpioStream stream;
+  const char *filename, *src = (const char *)RAMFS_ADDR;
+  char name[64], data[16];
+  void *content;
+  uint64_t filesize, mode, streamSize, streamMode;
+  size_t n;
+  if (fileIndex.archive != (void *)RAMFS_ADDR) {
+    uart_println("[cpio] initramfs not in place, skip");
+    return true;
+  }
+  cpioStreamInit(&stream, memoryPull, &src);
+  for (header = fileIndex.archive;; header = next) {
+    if (cpioParseHeader(header, &filename, &filesize, &mode, &content,
+                        &next)) {
+      break;
+    }
+    assert(cpioStreamNext(&stream, name, sizeof(name), &streamSize,
+                          &streamMode) == 0);
+    assert(strcmp(name, filename) == 0);
+    assert(streamSize == filesize && streamMode == mode);
+    // Partly read, the rest is skipped by the next call
+    n = cpioStreamRead(&stream, data, sizeof(data));
+    assert(n == min(sizeof(data), filesize));
+    assert(strncmp(data, content, n) == 0);
+  }
+  assert(cpioStreamNext(&stream, name, sizeof(name), &streamSize,
+                        &streamMode) == 1);
+  return true;
+}
+
+// Every entry of the initramfs is found through the index, as by a scan
+bool test_cpio_index() {
+  CpioNewcHeader *header, *next;
+  const char *filename;
+  void *data, *found;
+  uint64_t filesize;
+  unsigned long size;
+  if (fileIndex.archive != (void *)RAMFS_ADDR) {
+    uart_println("[cpio] initramfs not indexed, skip");
+    return true;
+  }
+  for (header = fileIndex.archive;; header = next) {
+    if (cpioParseHeader(header, &filename, &filesize, NULL, &data, &next)) {
+      break;
+    }
+    found = cpioGetFile(fileIndex.archive, filename, &size);
+    assert(found == data && size == filesize);
+  }
+  assert(cpioGetFile(fileIndex.archive, "no/such/file", &size) == NULL);
+  return true;
+}
+#endif
+
+void test_cpio() {
+#ifdef CFG_RUN_DEV_CPIO_TEST
+  unittest(test_cpio_parse_hex, "DEV", "CPIO - SWAR hex fields");
+  unittest(test_cpio_index, "DEV", "CPIO - hash index");
+  unittest(test_cpio_stream, "DEV", "CPIO - streaming reader");
+#endif
+}
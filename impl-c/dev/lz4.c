@@ -0,0 +1,280 @@
+#include "dev/lz4.h"
+#include "minmax.h"
+#include "mm.h"
+#include "string.h"
+
+#include "config.h"
+#include "log.h"
+#include "test.h"
+
+#ifdef CFG_LOG_DEV_LZ4
+static const int _DO_LOG = 1;
+#else
+static const int _DO_LOG = 0;
+#endif
+
+// Frame descriptor flags (FLG byte)
+#define LZ4_FLG_VERSION_MASK 0xc0
+#define LZ4_FLG_VERSION 0x40
+#define LZ4_FLG_BLOCK_INDEP (1 << 5)
+#define LZ4_FLG_BLOCK_CHECKSUM (1 << 4)
+#define LZ4_FLG_CONTENT_SIZE (1 << 3)
+#define LZ4_FLG_CONTENT_CHECKSUM (1 << 2)
+#define LZ4_FLG_DICT_ID (1 << 0)
+
+// Highest bit of a block size: the block is stored as is
+#define LZ4_BLOCK_UNCOMPRESSED 0x80000000u
+#define LZ4_MIN_MATCH 4
+
+// The frame is not aligned in any way
+static inline uint32_t read_le32(const uint8_t *p) {
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+         (uint32_t)p[3] << 24;
+}
+
+/**
+ * @brief Parse the frame header
+ * @retval the first block, NULL if the frame is not valid or not supported
+ */
+static const uint8_t *parse_header(const uint8_t *p, uint8_t *flg,
+                                   size_t *block_max) {
+  int max_id;
+  if (read_le32(p) != LZ4_FRAME_MAGIC) {
+    return NULL;
+  }
+  *flg = p[4];
+  max_id = (p[5] >> 4) & 0x7;
+  if ((*flg & LZ4_FLG_VERSION_MASK) != LZ4_FLG_VERSION || max_id < 4) {
+    return NULL;
+  }
+  // Blocks referencing earlier ones or a dictionary need a history window
+  if (!(*flg & LZ4_FLG_BLOCK_INDEP) || (*flg & LZ4_FLG_DICT_ID)) {
+    log_println("[lz4] linked blocks or dictionary not supported");
+    return NULL;
+  }
+  // 4: 64KB, 5: 256KB, 6: 1MB, 7: 4MB
+  *block_max = 1 << (2 * max_id + 8);
+  p += 6;
+  if (*flg & LZ4_FLG_CONTENT_SIZE) {
+    p += 8;
+  }
+  return p + 1; // header checksum
+}
+
+bool lz4_is_frame(const void *src) {
+  return read_le32(src) == LZ4_FRAME_MAGIC;
+}
+
+unsigned long lz4_frame_size(const void *src) {
+  const uint8_t *p;
+  uint8_t flg;
+  size_t block_max;
+  uint32_t size;
+  if ((p = parse_header(src, &flg, &block_max)) == NULL) {
+    return 0;
+  }
+  while ((size = read_le32(p)) != 0) {
+    p += 4 + (size & ~LZ4_BLOCK_UNCOMPRESSED);
+    if (flg & LZ4_FLG_BLOCK_CHECKSUM) {
+      p += 4;
+    }
+  }
+  p += 4; // EndMark
+  if (flg & LZ4_FLG_CONTENT_CHECKSUM) {
+    p += 4;
+  }
+  return p - (const uint8_t *)src;
+}
+
+int lz4_open(struct lz4_stream *s, const void *src) {
+  uint8_t flg;
+  if ((s->src = parse_header(src, &flg, &s->block_max)) == NULL) {
+    return -1;
+  }
+  s->block_checksum = flg & LZ4_FLG_BLOCK_CHECKSUM;
+  s->content_checksum = flg & LZ4_FLG_CONTENT_CHECKSUM;
+  s->end = false;
+  s->block = kalloc(s->block_max);
+  s->data = s->block;
+  s->pos = s->len = 0;
+  log_println("[lz4] open frame, block max: %d", s->block_max);
+  return 0;
+}
+
+void lz4_close(struct lz4_stream *s) {
+  kfree(s->block);
+  s->block = NULL;
+}
+
+// Add up a length continued in bytes of 255
+static inline bool read_length(const uint8_t **src, const uint8_t *end,
+                               size_t *len) {
+  uint8_t b;
+  do {
+    if (*src >= end) {
+      return false;
+    }
+    b = *(*src)++;
+    *len += b;
+  } while (b == 255);
+  return true;
+}
+
+/**
+ * @brief Decode a compressed block: sequences of literals followed by a
+ *  match (offset, length) into the bytes already decoded
+ * @retval decoded size, -1 if the block is broken
+ */
+static int64_t decode_block(const uint8_t *src, size_t src_len, uint8_t *dst,
+                            size_t dst_max) {
+  const uint8_t *end = src + src_len;
+  size_t out = 0, len, offset;
+  uint8_t token;
+  while (src < end) {
+    token = *src++;
+    len = token >> 4;
+    if (len == 15 && !read_length(&src, end, &len)) {
+      return -1;
+    }
+    if (len > (size_t)(end - src) || len > dst_max - out) {
+      return -1;
+    }
+    memcpy((char *)dst + out, (const char *)src, len);
+    src += len;
+    out += len;
+    // The last sequence has literals only
+    if (src == end) {
+      break;
+    }
+
+    if (end - src < 2) {
+      return -1;
+    }
+    offset = src[0] | src[1] << 8;
+    src += 2;
+    len = token & 0xf;
+    if (len == 15 && !read_length(&src, end, &len)) {
+      return -1;
+    }
+    len += LZ4_MIN_MATCH;
+    if (offset == 0 || offset > out || len > dst_max - out) {
+      return -1;
+    }
+    // Byte by byte, a match could overlap the bytes it produces
+    for (; len > 0; len--, out++) {
+      dst[out] = dst[out - offset];
+    }
+  }
+  return out;
+}
+
+// @retval false at the end of the frame, or on a broken block
+static bool next_block(struct lz4_stream *s) {
+  uint32_t size;
+  int64_t len;
+  if (s->end) {
+    return false;
+  }
+  size = read_le32(s->src);
+  s->src += 4;
+  if (size == 0) {
+    s->end = true;
+    return false;
+  }
+  if (size & LZ4_BLOCK_UNCOMPRESSED) {
+    // Read in place
+    size &= ~LZ4_BLOCK_UNCOMPRESSED;
+    s->data = s->src;
+    len = size;
+  } else {
+    s->data = s->block;
+    len = decode_block(s->src, size, s->block, s->block_max);
+  }
+  if (len < 0 || (size_t)len > s->block_max) {
+    log_println("[lz4] broken block");
+    s->end = true;
+    return false;
+  }
+  s->src += size + (s->block_checksum ? 4 : 0);
+  s->pos = 0;
+  s->len = len;
+  return true;
+}
+
+size_t lz4_read(struct lz4_stream *s, void *buf, size_t len) {
+  char *dst = buf;
+  size_t done = 0, n;
+  while (done < len) {
+    if (s->pos == s->len && !next_block(s)) {
+      break;
+    }
+    n = min(len - done, s->len - s->pos);
+    if (dst != NULL) {
+      memcpy(dst + done, (const char *)s->data + s->pos, n);
+    }
+    s->pos += n;
+    done += n;
+  }
+  return done;
+}
+
+#ifdef CFG_RUN_DEV_LZ4_TEST
+// "abcabcabcabcXYZend": a match overlapping itself, then a stored block
+static const uint8_t test_frame[] = {
+    // Header: magic, FLG (independent blocks), BD (64KB), checksum
+    0x04, 0x22, 0x4d, 0x18, 0x60, 0x40, 0x82,
+    // Compressed block of 10 bytes: "abc" + match(offset 3, length 9),
+    // then "XYZ"
+    0x0a, 0x00, 0x00, 0x00, 0x35, 'a', 'b', 'c', 0x03, 0x00, 0x30, 'X', 'Y',
+    'Z',
+    // Stored block
+    0x03, 0x00, 0x00, 0x80, 'e', 'n', 'd',
+    // EndMark
+    0x00, 0x00, 0x00, 0x00};
+
+bool test_lz4_read() {
+  struct lz4_stream s;
+  char buf[32];
+  assert(lz4_is_frame(test_frame));
+  assert(lz4_frame_size(test_frame) == sizeof(test_frame));
+  assert(lz4_open(&s, test_frame) == 0);
+  assert(s.block_max == 64 * 1024);
+
+  // Across blocks, in pieces
+  assert(lz4_read(&s, buf, 4) == 4);
+  assert(lz4_read(&s, NULL, 6) == 6);
+  assert(lz4_read(&s, buf + 4, sizeof(buf)) == 8);
+  assert(strncmp(buf, "abcabcXYZend", 12) == 0);
+  assert(lz4_read(&s, buf, 1) == 0);
+  lz4_close(&s);
+  return true;
+}
+
+bool test_lz4_broken() {
+  struct lz4_stream s;
+  uint8_t frame[sizeof(test_frame)];
+  char buf[32];
+  memcpy((char *)frame, (const char *)test_frame, sizeof(frame));
+
+  // Match before the start of the block
+  frame[15] = 0x04;
+  assert(lz4_open(&s, frame) == 0);
+  assert(lz4_read(&s, buf, sizeof(buf)) == 0);
+  lz4_close(&s);
+
+  // Linked blocks
+  frame[4] = 0x40;
+  assert(lz4_open(&s, frame) == -1);
+  assert(lz4_frame_size(frame) == 0);
+  frame[0] = 0;
+  assert(!lz4_is_frame(frame));
+  return true;
+}
+#endif
+
+void test_lz4() {
+#ifdef CFG_RUN_DEV_LZ4_TEST
+  unittest(test_lz4_read, "DEV", "LZ4 - streaming read");
+  unittest(test_lz4_broken, "DEV", "LZ4 - broken frame");
+#endif
+}
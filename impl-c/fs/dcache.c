@@ -0,0 +1,179 @@
+#include "fs/dcache.h"
+
+#include "list.h"
+#include "spinlock.h"
+#include "string.h"
+
+#include "config.h"
+#include "test.h"
+
+#include <stddef.h>
+
+static struct dentry dentries[DCACHE_SIZE];
+static struct list_head buckets[DCACHE_BUCKETS];
+static struct list_head lru;
+
+// Lookups run in parallel under the read side of the vfs tree lock
+static spinlock_t dcache_lock = SPINLOCK_INIT("dcache");
+
+#define lru_dentry(entry) list_entry(entry, struct dentry, lru)
+#define hash_dentry(entry) list_entry(entry, struct dentry, hash)
+
+void dcache_init() {
+  spin_lock(&dcache_lock);
+  list_init(&lru);
+  for (int i = 0; i < DCACHE_BUCKETS; i++) {
+    list_init(&buckets[i]);
+  }
+  for (int i = 0; i < DCACHE_SIZE; i++) {
+    list_init(&dentries[i].hash);
+    list_push(&dentries[i].lru, &lru);
+  }
+  spin_unlock(&dcache_lock);
+}
+
+static inline struct list_head *bucket_of(struct vnode *parent,
+                                          uint32_t hash) {
+  uintptr_t p = (uintptr_t)parent;
+  return &buckets[(hash ^ (uint32_t)(p >> 4) ^ (uint32_t)(p >> 16)) &
+                  (DCACHE_BUCKETS - 1)];
+}
+
+static struct dentry *__find(struct vnode *parent,
+                             const struct component *name) {
+  struct list_head *head = bucket_of(parent, name->hash), *entry;
+  for (entry = head->next; entry != head; entry = entry->next) {
+    struct dentry *d = hash_dentry(entry);
+    if (d->name_hash == name->hash && d->parent == parent &&
+        d->len == name->len && component_eq(name, d->name)) {
+      return d;
+    }
+  }
+  return NULL;
+}
+
+// Mark as most recently used
+static inline void __touch(struct dentry *d) {
+  list_del(&d->lru);
+  list_push(&d->lru, &lru);
+}
+
+bool dcache_lookup(struct vnode *parent, const struct component *name,
+                   struct vnode **node) {
+  struct dentry *d;
+  if (name->len > DNAME_MAX) {
+    return false;
+  }
+  spin_lock(&dcache_lock);
+  d = __find(parent, name);
+  if (d != NULL) {
+    __touch(d);
+    *node = d->node;
+  }
+  spin_unlock(&dcache_lock);
+  return d != NULL;
+}
+
+void dcache_insert(struct vnode *parent, const struct component *name,
+                   struct vnode *node) {
+  struct dentry *d;
+  if (name->len > DNAME_MAX) {
+    return;
+  }
+  spin_lock(&dcache_lock);
+  d = __find(parent, name);
+  if (d == NULL) {
+    // Recycle the least recently used one
+    d = lru_dentry(lru.next);
+    if (!list_empty(&d->hash)) {
+      list_del(&d->hash);
+    }
+    d->parent = parent;
+    d->name_hash = name->hash;
+    d->len = name->len;
+    memcpy(d->name, name->name, name->len);
+    d->name[name->len] = '\0';
+    list_push(&d->hash, bucket_of(parent, name->hash));
+  }
+  d->node = node;
+  __touch(d);
+  spin_unlock(&dcache_lock);
+}
+
+#ifdef CFG_RUN_FS_DCACHE_TEST
+static bool cached(struct vnode *parent, const char *name,
+                   struct vnode **node) {
+  struct component c;
+  component_init(&c, name, strlen(name));
+  return dcache_lookup(parent, &c, node);
+}
+
+static void insert(struct vnode *parent, const char *name,
+                   struct vnode *node) {
+  struct component c;
+  component_init(&c, name, strlen(name));
+  dcache_insert(parent, &c, node);
+}
+
+bool test_dcache_lookup() {
+  struct vnode dir1, dir2, file;
+  struct vnode *node;
+  dcache_init();
+
+  assert(!cached(&dir1, "dev", &node));
+  insert(&dir1, "dev", &file);
+  assert(cached(&dir1, "dev", &node) && node == &file);
+  // Keyed by parent and full name
+  assert(!cached(&dir2, "dev", &node));
+  assert(!cached(&dir1, "de", &node));
+  assert(!cached(&dir1, "devs", &node));
+
+  // Negative entry, then created
+  insert(&dir2, "dev", NULL);
+  assert(cached(&dir2, "dev", &node) && node == NULL);
+  insert(&dir2, "dev", &file);
+  assert(cached(&dir2, "dev", &node) && node == &file);
+
+  // Too long to be cached
+  const char *longname = "a_file_name_longer_than_dname_max";
+  insert(&dir1, longname, &file);
+  assert(!cached(&dir1, longname, &node));
+  return true;
+}
+
+bool test_dcache_lru() {
+  struct vnode dir, file;
+  struct vnode *node;
+  char name[4] = {'f', 0, 0, 0};
+  dcache_init();
+
+  insert(&dir, "keep", &file);
+  // Overflow the pool by two, touching "keep" so it stays recently used
+  for (int i = 0; i <= DCACHE_SIZE; i++) {
+    name[1] = 'a' + i / 26;
+    name[2] = 'a' + i % 26;
+    insert(&dir, name, &file);
+    assert(cached(&dir, "keep", &node));
+  }
+  // The oldest ones are evicted
+  name[1] = 'a', name[2] = 'a';
+  assert(!cached(&dir, name, &node));
+  name[2] = 'b';
+  assert(!cached(&dir, name, &node));
+  name[2] = 'c';
+  assert(cached(&dir, name, &node));
+  name[1] = 'a' + DCACHE_SIZE / 26;
+  name[2] = 'a' + DCACHE_SIZE % 26;
+  assert(cached(&dir, name, &node) && node == &file);
+
+  dcache_init();
+  return true;
+}
+#endif
+
+void test_dcache() {
+#ifdef CFG_RUN_FS_DCACHE_TEST
+  unittest(test_dcache_lookup, "FS", "dcache - lookup & negative entry");
+  unittest(test_dcache_lru, "FS", "dcache - LRU eviction");
+#endif
+}
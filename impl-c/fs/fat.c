@@ -1,4 +1,5 @@
 #include "fs/fat.h"
+#include "fs/pagecache.h"
 #include "fs/vfs.h"
 
 #include "dev/mbr.h"
@@ -7,6 +8,7 @@
 #include "fatal.h"
 #include "minmax.h"
 #include "mm.h"
+#include "spinlock.h"
 #include "stdint.h"
 #include "string.h"
 #include "uart.h"
@@ -27,15 +29,22 @@ static const int _DO_LOG = 0;
 
 #define FAT_NODE_TYPE_DIR 1
 #define FAT_NODE_TYPE_FILE 2
+// File data goes through the page cache, a dir is copied into `data` as a
+// whole to build its children
 typedef struct {
   char *name;
   uint8_t node_type;
   size_t capacity; // In memory
   size_t size;
 
-  char *data;                // data in memory (directly copied from SDcard)
+  char *data;                // dir data in memory (copied from SDcard)
   uint32_t start_cluster_id; // Start idx inside the SD card
 
+  // Last cluster reached in the chain and its position, where the next
+  // page walk starts from if it's not behind
+  uint32_t hint_cluster_id;
+  size_t hint_cluster_nr;
+
   // Information in SD card
   size_t cur_sd_capacity;
 
@@ -107,46 +116,59 @@ static enum FAT_DentryType dentry_type(struct Dentry *dentry);
 int fat_initialized = false;
 struct vnode_operations *fat_v_ops = NULL;
 struct file_operations *fat_f_ops = NULL;
+struct page_cache_operations *fat_p_ops = NULL;
 
 struct filesystem fat = {
     .name = "fat32", .setup_mount = fat_setup_mount, .next = NULL};
 
 struct BackingStoreInfo fatConfig;
 
+// Serialize access to fatConfig, the allocation table and the lazily built
+// caches (file data and directory children)
+static spinlock_t fat_lock = SPINLOCK_INIT("fat");
+
 static int parse_backing_store_info();
 static int get_fat_config(uint32_t partition_lba_begin,
                           struct BackingStoreInfo *keyInfo);
 static uint32_t fetch_file(uint32_t begin_lba, void **ret_file);
 static int follow_cluster_chain(uint32_t cluster_idx,
                                 /* Return */ size_t *ret_len);
-static struct vnode *create_vnode(const char *name, uint8_t node_type,
-                                  uint32_t start_cluster_id,
+static struct vnode *create_vnode(const char *name, int len,
+                                  uint8_t node_type, uint32_t start_cluster_id,
                                   struct vnode *parent);
 static inline uint32_t cluster2lba(uint32_t clusterId) {
   return fatConfig.cluster_begin_lba +
          (clusterId - 2) * fatConfig.sec_per_cluster;
 }
 static int build_dir_cache(struct vnode *dir_node);
+static int fat_readpage(struct vnode *node, size_t index, char *page);
+static int fat_writepage(struct vnode *node, size_t index, const char *page);
 static struct vnode *create_vnode_from_dentry(struct Dentry *dentry,
                                               struct vnode *parent);
 
-struct vnode *create_vnode(const char *name, uint8_t node_type,
+struct vnode *create_vnode(const char *name, int len, uint8_t node_type,
                            uint32_t start_cluster_id, struct vnode *parent) {
   struct vnode *node = (struct vnode *)kalloc(sizeof(struct vnode));
 
   // This node is not mounted by other directory
   node->mnt = NULL;
+  node->parent = parent;
+  node->is_dir = node_type == FAT_NODE_TYPE_DIR;
   node->v_ops = fat_v_ops;
   node->f_ops = fat_f_ops;
+  node->p_ops = fat_p_ops;
 
   Content *cnt = kalloc(sizeof(Content));
   {
-    cnt->name = (char *)kalloc(sizeof(char) * strlen(name));
-    strcpy(cnt->name, name);
+    cnt->name = (char *)kalloc(sizeof(char) * (len + 1));
+    memcpy(cnt->name, name, len);
+    cnt->name[len] = '\0';
     cnt->node_type = node_type;
     cnt->size = 0;
     cnt->capacity = 0;
     cnt->start_cluster_id = start_cluster_id;
+    cnt->hint_cluster_id = start_cluster_id;
+    cnt->hint_cluster_nr = 0;
 
     // Data should be fetched on demand
     // dir: fat_lookup
@@ -164,11 +186,13 @@ struct vnode *create_vnode(const char *name, uint8_t node_type,
 void fat_dev() {
   fat_init();
   struct vnode *root_dir =
-      create_vnode("/", FAT_NODE_TYPE_DIR, fatConfig.root_cluster, NULL);
+      create_vnode("/", 1, FAT_NODE_TYPE_DIR, fatConfig.root_cluster, NULL);
 
   struct vnode *target;
+  struct component name;
   int ret;
-  ret = fat_lookup(root_dir, &target, "FIXUP.DAT");
+  component_init(&name, "FIXUP.DAT", 9);
+  ret = fat_lookup(root_dir, &target, &name);
   if (ret == 0) {
     uart_println("found node: %s", node_name(target));
   } else {
@@ -177,16 +201,18 @@ void fat_dev() {
 }
 
 int fat_setup_mount(struct filesystem *fs, struct mount *mount) {
+  spin_lock(&fat_lock);
   if (fat_initialized == false) {
     fat_init();
     fat_initialized = true;
   }
+  spin_unlock(&fat_lock);
 
   // The actual name of this vnode is defined in the parent vnode of the
   // mounting point
   // The nameing here is for better logging
-  struct vnode *root =
-      create_vnode("#sdcard", FAT_NODE_TYPE_DIR, fatConfig.root_cluster, NULL);
+  struct vnode *root = create_vnode("#sdcard", 7, FAT_NODE_TYPE_DIR,
+                                    fatConfig.root_cluster, NULL);
   mount->root = root;
   log_println("[FAT] FAT32 filesystem mounted");
   return 0;
@@ -201,6 +227,10 @@ int fat_init() {
   fat_f_ops->read = fat_read;
   fat_f_ops->write = fat_write;
 
+  fat_p_ops = kalloc(sizeof(struct page_cache_operations));
+  fat_p_ops->readpage = fat_readpage;
+  fat_p_ops->writepage = fat_writepage;
+
   if (0 != parse_backing_store_info()) {
     FATAL("Could not parse FAT information from SD card");
     return 1;
@@ -217,71 +247,46 @@ int fat_init() {
   return 0;
 }
 
-int fat_write(struct file *f, const void *buf, unsigned long len) {
+static int __fat_write(struct file *f, const void *buf, unsigned long len) {
   Content *content = content_ptr(f->node);
-  size_t request_end = f->f_pos + len;
-  uart_println("[FAT][Write] Receive write request: f_pos:%d, len:%d", f->f_pos,
-               len);
-  // TODO: support writing to/from SD card
-  // Need to enlarge size
-  if (request_end > content->capacity) {
-    size_t new_size = request_end << 1;
-    log_println("[FAT] Enlarge file capacity from %d to %d", content->capacity,
-                new_size);
-    char *new_data = kalloc(sizeof(char) * new_size);
-    if (content->data != NULL) {
-      memcpy(new_data, content->data, content->size);
-      kfree(content->data);
-    }
-    content->data = new_data;
-    content->capacity = new_size;
-  }
-  memcpy(&content->data[f->f_pos], buf, len);
+  log_println("[FAT][Write] Receive write request: f_pos:%d, len:%d", f->f_pos,
+              len);
+  len = pcache_write(f->node, f->f_pos, buf, len);
   f->f_pos += len;
-  content->size = max(request_end, content->size);
+  content->size = max(f->f_pos, content->size);
   log_println("[FAT] write: `%s`, len:%d", node_name(f->node), len);
   return len;
-  return -1;
 }
 
-int fat_read(struct file *f, void *buf, unsigned long len) {
-  // TODO: support writing to/from SD card
+static int __fat_read(struct file *f, void *buf, unsigned long len) {
   Content *content = content_ptr(f->node);
-  size_t request_end = f->f_pos + len;
-  size_t read_len = min(request_end, content->size) - f->f_pos;
+  size_t read_len;
   log_println("[FAT][Read] Receive read request: f_pos:%d, size:%d", f->f_pos,
               len);
-
-  // lazy load data from SD card
-  if (content->data == NULL) {
-    {
-      log_println("[FAT][Read] File data not in memory, fetch from SD card");
-      uint32_t num_sector =
-          fetch_file(content->start_cluster_id, (void **)&content->data);
-      // Capacity in byte (1sector -> 512 bytes)
-      log_println(
-          "[FAT][Read]  ... fetched `%s`(start_cluster_id:%d, num_sectors:%d)",
-          node_name(f->node), content->start_cluster_id, num_sector);
-      content->capacity = num_sector * 512;
-    }
+  if (f->f_pos >= content->size) {
+    return 0;
   }
-
-  memcpy(buf, &content->data[f->f_pos], read_len);
+  // Pages missing from the cache are read from SD card
+  read_len = min((size_t)len, content->size - f->f_pos);
+  read_len = pcache_read(f->node, f->f_pos, buf, read_len);
   f->f_pos += read_len;
   log_println("[FAT][Read] read: `%s`, len:%d", node_name(f->node), read_len);
   return read_len;
 }
 
-int fat_lookup(struct vnode *dir_node, struct vnode **target,
-               const char *component_name) {
+static int __fat_lookup(struct vnode *dir_node, struct vnode **target,
+                        const struct component *name) {
 
   Content *dir_content = content_ptr(dir_node);
   if (dir_content->node_type != FAT_NODE_TYPE_DIR) {
     uart_println("Only able to lookup dir");
     return -1;
   }
-  log_println("[FAT][Lookup] Find `%s` under node:`%s`", component_name,
-              node_name(dir_node));
+  if (_DO_LOG) {
+    log_printf("[FAT][Lookup] Find `");
+    component_puts(name);
+    log_println("` under node:`%s`", node_name(dir_node));
+  }
 
   if (dir_content->data == NULL) {
     // Pull data from SD card
@@ -307,10 +312,8 @@ int fat_lookup(struct vnode *dir_node, struct vnode **target,
   }
 
   dir_content = content_ptr(dir_node);
-  const char *child_name;
   for (int i = 0; i < dir_content->size; i++) {
-    child_name = node_name(dir_content->children[i]);
-    if (0 == strcmp(child_name, component_name)) {
+    if (component_eq(name, node_name(dir_content->children[i]))) {
       if (target != NULL) {
         *target = dir_content->children[i];
       }
@@ -323,13 +326,14 @@ int fat_lookup(struct vnode *dir_node, struct vnode **target,
   return -1;
 }
 
-int fat_create(struct vnode *dir_node, struct vnode **target,
-               const char *component_name) {
+static int __fat_create(struct vnode *dir_node, struct vnode **target,
+                        const struct component *name) {
   struct vnode *child_node;
 
   Content *child_content, *parent_content;
   // TODO: write back to the FAT
-  child_node = create_vnode(component_name, FAT_NODE_TYPE_FILE, -1, dir_node);
+  child_node =
+      create_vnode(name->name, name->len, FAT_NODE_TYPE_FILE, -1, dir_node);
   child_content = content_ptr(child_node);
   child_content->size = 0;
 
@@ -344,6 +348,36 @@ int fat_create(struct vnode *dir_node, struct vnode **target,
   return 0;
 }
 
+int fat_write(struct file *f, const void *buf, unsigned long len) {
+  spin_lock(&fat_lock);
+  int ret = __fat_write(f, buf, len);
+  spin_unlock(&fat_lock);
+  return ret;
+}
+
+int fat_read(struct file *f, void *buf, unsigned long len) {
+  spin_lock(&fat_lock);
+  int ret = __fat_read(f, buf, len);
+  spin_unlock(&fat_lock);
+  return ret;
+}
+
+int fat_lookup(struct vnode *dir_node, struct vnode **target,
+               const struct component *name) {
+  spin_lock(&fat_lock);
+  int ret = __fat_lookup(dir_node, target, name);
+  spin_unlock(&fat_lock);
+  return ret;
+}
+
+int fat_create(struct vnode *dir_node, struct vnode **target,
+               const struct component *name) {
+  spin_lock(&fat_lock);
+  int ret = __fat_create(dir_node, target, name);
+  spin_unlock(&fat_lock);
+  return ret;
+}
+
 int parse_backing_store_info() {
   int ret = 0;
 
@@ -491,6 +525,81 @@ uint32_t fetch_file(uint32_t cluster_idx, void **ret_file) {
   return num_sectors;
 }
 
+static inline bool in_chain(uint32_t cluster_idx) {
+  return cluster_idx >= 2 && cluster_idx < 0xFFFFFF8;
+}
+
+/**
+ * @brief Find the sectors of a page by following the file's cluster chain,
+ *  from the cluster holding the first one to those the page crosses into
+ * @param lba return PCACHE_PAGE_SIZE / 512 lba, 0 for sectors past the chain
+ */
+static void page_sectors(Content *content, size_t index, uint32_t *lba) {
+  const size_t sectors = PCACHE_PAGE_SIZE / 512;
+  size_t n = index * sectors, nr = n / fatConfig.sec_per_cluster;
+  uint32_t cluster_idx = content->start_cluster_id;
+  size_t i = 0;
+  if (content->hint_cluster_nr <= nr) {
+    cluster_idx = content->hint_cluster_id;
+    i = content->hint_cluster_nr;
+  }
+  for (; i < nr && in_chain(cluster_idx); i++) {
+    cluster_idx = fatConfig.alloc_table[cluster_idx];
+  }
+  if (in_chain(cluster_idx)) {
+    content->hint_cluster_id = cluster_idx;
+    content->hint_cluster_nr = nr;
+  }
+  for (i = 0; i < sectors; i++, n++) {
+    if (i > 0 && n % fatConfig.sec_per_cluster == 0 && in_chain(cluster_idx)) {
+      cluster_idx = fatConfig.alloc_table[cluster_idx];
+    }
+    lba[i] = in_chain(cluster_idx)
+                 ? cluster2lba(cluster_idx) + n % fatConfig.sec_per_cluster
+                 : 0;
+  }
+}
+
+// Sectors past the cluster chain (e.g. of a created file) read as zeros
+static int fat_readpage(struct vnode *node, size_t index, char *page) {
+  uint32_t lba[PCACHE_PAGE_SIZE / 512];
+  page_sectors(content_ptr(node), index, lba);
+  for (size_t i = 0; i < PCACHE_PAGE_SIZE / 512; i++) {
+    if (lba[i] != 0) {
+      readblock(lba[i], page + i * 512);
+    } else {
+      for (int j = 0; j < 512; j++) {
+        page[i * 512 + j] = 0;
+      }
+    }
+  }
+  log_println("[FAT] readpage: `%s`, page:%d", node_name(node), index);
+  return 0;
+}
+
+/**
+ * Only sectors already allocated to the file are written, a page reaching
+ * past the cluster chain fails as no cluster is allocated yet (the page then
+ * stays in the cache)
+ */
+static int fat_writepage(struct vnode *node, size_t index, const char *page) {
+  Content *content = content_ptr(node);
+  uint32_t lba[PCACHE_PAGE_SIZE / 512];
+  size_t start = index * PCACHE_PAGE_SIZE, i;
+  size_t end = min(content->size, start + PCACHE_PAGE_SIZE);
+  page_sectors(content, index, lba);
+  for (i = 0; start + i * 512 < end; i++) {
+    if (lba[i] == 0) {
+      return -1;
+    }
+  }
+  for (i = 0; start + i * 512 < end; i++) {
+    writeblock(lba[i], (void *)(page + i * 512));
+  }
+  log_println("[FAT] writepage: `%s`, page:%d", node_name(node), index);
+  return 0;
+}
+
 static enum FAT_DentryType dentry_type(struct Dentry *dentry) {
   uint8_t *first_byte = (uint8_t *)dentry;
   switch (*first_byte) {
@@ -537,7 +646,8 @@ struct vnode *create_vnode_from_dentry(struct Dentry *dentry,
   uint32_t cluster_id =
       (dentry->first_cluster_high << 16) + dentry->first_cluster_low;
 
-  struct vnode *node = create_vnode(name, vnode_type, cluster_id, parent);
+  struct vnode *node =
+      create_vnode(name, strlen(name), vnode_type, cluster_id, parent);
   Content *content = content_ptr(node);
   content->size = dentry->size;
   return node;
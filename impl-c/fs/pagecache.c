@@ -0,0 +1,349 @@
+#include "fs/pagecache.h"
+
+#include "minmax.h"
+#include "mm.h"
+#include "spinlock.h"
+#include "string.h"
+
+#include "config.h"
+#include "log.h"
+#include "test.h"
+
+#include <stdint.h>
+
+#ifdef CFG_LOG_PCACHE
+static const int _DO_LOG = 1;
+#else
+static const int _DO_LOG = 0;
+#endif
+
+static struct list_head buckets[PCACHE_BUCKETS];
+static struct list_head lru;
+static int nr_pages;
+static int nr_dirty;
+
+// Held across readpage/writepage, filesystems must not call back into here
+static spinlock_t pcache_lock = SPINLOCK_INIT("pcache");
+
+#define lru_page(entry) list_entry(entry, struct cached_page, lru)
+#define hash_page(entry) list_entry(entry, struct cached_page, hash)
+
+void pcache_init() {
+  spin_lock(&pcache_lock);
+  list_init(&lru);
+  for (int i = 0; i < PCACHE_BUCKETS; i++) {
+    list_init(&buckets[i]);
+  }
+  nr_pages = nr_dirty = 0;
+  spin_unlock(&pcache_lock);
+}
+
+static inline struct list_head *bucket_of(struct vnode *node, size_t index) {
+  uintptr_t p = (uintptr_t)node;
+  return &buckets[((uint32_t)(p >> 4) ^ (uint32_t)(p >> 16) ^
+                   (uint32_t)index * 2654435761u) &
+                  (PCACHE_BUCKETS - 1)];
+}
+
+static struct cached_page *__find(struct vnode *node, size_t index) {
+  struct list_head *head = bucket_of(node, index), *entry;
+  for (entry = head->next; entry != head; entry = entry->next) {
+    struct cached_page *p = hash_page(entry);
+    if (p->node == node && p->index == index) {
+      return p;
+    }
+  }
+  return NULL;
+}
+
+// Mark as most recently used
+static inline void __touch(struct cached_page *p) {
+  list_del(&p->lru);
+  list_push(&p->lru, &lru);
+}
+
+// @retval 0 if the page is clean afterwards
+static int __writeback(struct cached_page *p) {
+  if (!p->dirty) {
+    return 0;
+  }
+  if (p->node->p_ops->writepage(p->node, p->index, p->data) != 0) {
+    return -1;
+  }
+  p->dirty = false;
+  nr_dirty--;
+  return 0;
+}
+
+static inline void __mark_dirty(struct cached_page *p) {
+  if (!p->dirty) {
+    p->dirty = true;
+    nr_dirty++;
+  }
+}
+
+/**
+ * @brief Make room for one more dirty page, writing back the least recently
+ *  used ones while at the limit
+ * @retval 0 for succeed, -1 if no dirty page could be written back
+ */
+static int __reserve_dirty() {
+  struct list_head *entry;
+  for (entry = lru.next; nr_dirty >= PCACHE_MAX_DIRTY && entry != &lru;
+       entry = entry->next) {
+    __writeback(lru_page(entry));
+  }
+  if (nr_dirty >= PCACHE_MAX_DIRTY) {
+    log_println("[pcache] %d dirty pages, none written back", nr_dirty);
+    return -1;
+  }
+  return 0;
+}
+
+static void __release(struct cached_page *p) {
+  list_del(&p->hash);
+  list_del(&p->lru);
+  if (p->dirty) {
+    nr_dirty--;
+  }
+  kfree(p->data);
+  kfree(p);
+  nr_pages--;
+}
+
+/**
+ * Take a page out of the cache for reuse, a new one while under the limit.
+ * At most PCACHE_MAX_DIRTY pages are dirty, so a clean one is always there to
+ * evict when writing back fails
+ */
+static struct cached_page *__get_free() {
+  struct list_head *entry;
+  struct cached_page *p;
+  if (nr_pages >= PCACHE_MAX_PAGES) {
+    for (entry = lru.next; entry != &lru; entry = entry->next) {
+      p = lru_page(entry);
+      if (__writeback(p) == 0) {
+        log_println("[pcache] evict page %d of %x", p->index, p->node);
+        list_del(&p->hash);
+        list_del(&p->lru);
+        return p;
+      }
+    }
+    return NULL;
+  }
+  p = kalloc(sizeof(struct cached_page));
+  p->data = kalloc(PCACHE_PAGE_SIZE);
+  nr_pages++;
+  return p;
+}
+
+/**
+ * @brief Find a cached page, or cache it on a miss
+ * @param fill whether a new page is filled by readpage (false if the caller
+ *  overwrites it as a whole)
+ * @retval NULL if the page could not be filled or allocated
+ */
+static struct cached_page *__get(struct vnode *node, size_t index,
+                                 bool fill) {
+  struct cached_page *p = __find(node, index);
+  if (p != NULL) {
+    __touch(p);
+    return p;
+  }
+  if ((p = __get_free()) == NULL) {
+    return NULL;
+  }
+  p->node = node;
+  p->index = index;
+  p->dirty = false;
+  list_push(&p->hash, bucket_of(node, index));
+  list_push(&p->lru, &lru);
+  if (fill && node->p_ops->readpage(node, index, p->data) != 0) {
+    __release(p);
+    return NULL;
+  }
+  return p;
+}
+
+size_t pcache_read(struct vnode *node, size_t pos, void *buf, size_t len) {
+  char *dst = buf;
+  size_t end = pos + len, chunk, offset;
+  struct cached_page *p;
+  spin_lock(&pcache_lock);
+  for (; pos < end; pos += chunk, dst += chunk) {
+    if ((p = __get(node, pos >> PCACHE_PAGE_SHIFT, true)) == NULL) {
+      break;
+    }
+    offset = pos & (PCACHE_PAGE_SIZE - 1);
+    chunk = min(PCACHE_PAGE_SIZE - offset, end - pos);
+    memcpy(dst, p->data + offset, chunk);
+  }
+  spin_unlock(&pcache_lock);
+  return len - (end - pos);
+}
+
+size_t pcache_write(struct vnode *node, size_t pos, const void *buf,
+                    size_t len) {
+  const char *src = buf;
+  size_t end = pos + len, chunk, offset;
+  struct cached_page *p;
+  spin_lock(&pcache_lock);
+  for (; pos < end; pos += chunk, src += chunk) {
+    offset = pos & (PCACHE_PAGE_SIZE - 1);
+    chunk = min(PCACHE_PAGE_SIZE - offset, end - pos);
+    p = __find(node, pos >> PCACHE_PAGE_SHIFT);
+    if ((p == NULL || !p->dirty) && __reserve_dirty() != 0) {
+      break;
+    }
+    p = __get(node, pos >> PCACHE_PAGE_SHIFT, chunk < PCACHE_PAGE_SIZE);
+    if (p == NULL) {
+      break;
+    }
+    memcpy(p->data + offset, src, chunk);
+    __mark_dirty(p);
+  }
+  spin_unlock(&pcache_lock);
+  return len - (end - pos);
+}
+
+int pcache_sync(struct vnode *node) {
+  struct list_head *entry;
+  int ret = 0;
+  spin_lock(&pcache_lock);
+  for (entry = lru.next; entry != &lru; entry = entry->next) {
+    struct cached_page *p = lru_page(entry);
+    if ((node == NULL || p->node == node) && __writeback(p) != 0) {
+      ret = -1;
+    }
+  }
+  spin_unlock(&pcache_lock);
+  return ret;
+}
+
+void pcache_drop(struct vnode *node) {
+  struct list_head *entry, *next;
+  spin_lock(&pcache_lock);
+  for (entry = lru.next; entry != &lru; entry = next) {
+    struct cached_page *p = lru_page(entry);
+    next = entry->next;
+    if (p->node == node) {
+      __writeback(p);
+      __release(p);
+    }
+  }
+  spin_unlock(&pcache_lock);
+}
+
+#ifdef CFG_RUN_FS_PCACHE_TEST
+// A device where byte i of page n holds n + i, counting page I/O. Writing
+// back fails for the `pinned` page, or any page unless `writable`
+static int nr_reads, nr_writes, last_write;
+static bool writable;
+static size_t pinned;
+
+static int test_readpage(struct vnode *node, size_t index, char *page) {
+  for (int i = 0; i < PCACHE_PAGE_SIZE; i++) {
+    page[i] = (char)(index + i);
+  }
+  nr_reads++;
+  return 0;
+}
+
+static int test_writepage(struct vnode *node, size_t index,
+                          const char *page) {
+  if (!writable || index == pinned) {
+    return -1;
+  }
+  nr_writes++;
+  last_write = index;
+  return 0;
+}
+
+static struct page_cache_operations test_p_ops = {
+    .readpage = test_readpage, .writepage = test_writepage};
+
+bool test_pcache_read_write() {
+  struct vnode node = {.p_ops = &test_p_ops};
+  struct vnode other = {.p_ops = &test_p_ops};
+  char buf[8];
+  pcache_init();
+  nr_reads = nr_writes = 0;
+  writable = true;
+  pinned = -1;
+
+  // Filled once, shared by every reader of the vnode
+  assert(pcache_read(&node, PCACHE_PAGE_SIZE - 2, buf, 4) == 4);
+  assert(nr_reads == 2);
+  assert(buf[0] == (char)(PCACHE_PAGE_SIZE - 2) && buf[2] == 1);
+  assert(pcache_read(&node, 3, buf, 1) == 1 && buf[0] == 3);
+  assert(nr_reads == 2);
+  assert(pcache_read(&other, 3, buf, 1) == 1 && nr_reads == 3);
+
+  // Written back on sync only
+  assert(pcache_write(&node, 5, "abc", 3) == 3);
+  assert(pcache_read(&node, 4, buf, 5) == 5);
+  assert(strncmp(buf, "\4abc\10", 5) == 0);
+  assert(nr_writes == 0);
+  assert(pcache_sync(&other) == 0 && nr_writes == 0);
+  assert(pcache_sync(&node) == 0 && nr_writes == 1 && last_write == 0);
+  assert(pcache_sync(NULL) == 0 && nr_writes == 1);
+  assert(nr_dirty == 0);
+
+  pcache_drop(&node);
+  pcache_drop(&other);
+  assert(nr_pages == 0);
+  return true;
+}
+
+bool test_pcache_evict() {
+  static char page[PCACHE_PAGE_SIZE];
+  struct vnode node = {.p_ops = &test_p_ops};
+  size_t index;
+  pcache_init();
+  nr_reads = nr_writes = 0;
+  writable = true;
+  pinned = 0;
+
+  // Fill the cache, page 0 dirty and the others clean
+  assert(pcache_write(&node, 0, "x", 1) == 1);
+  for (index = 1; index < PCACHE_MAX_PAGES; index++) {
+    assert(pcache_read(&node, index * PCACHE_PAGE_SIZE, page, 1) == 1);
+  }
+  assert(nr_pages == PCACHE_MAX_PAGES && nr_reads == PCACHE_MAX_PAGES);
+
+  // Page 0 can't be written back, page 1 is the oldest one to evict
+  assert(pcache_read(&node, index * PCACHE_PAGE_SIZE, page, 1) == 1);
+  assert(nr_pages == PCACHE_MAX_PAGES && nr_writes == 0);
+  assert(pcache_read(&node, 0, page, 1) == 1 && page[0] == 'x');
+  assert(nr_reads == PCACHE_MAX_PAGES + 1);
+
+  // Writes stop at the dirty limit while nothing could be written back
+  writable = false;
+  for (index = 1; index < PCACHE_MAX_DIRTY; index++) {
+    assert(pcache_write(&node, index * PCACHE_PAGE_SIZE, page,
+                        sizeof(page)) == sizeof(page));
+  }
+  assert(nr_dirty == PCACHE_MAX_DIRTY);
+  assert(pcache_write(&node, index * PCACHE_PAGE_SIZE, page, 1) == 0);
+  assert(pcache_write(&node, 1, "y", 1) == 1);
+  assert(pcache_sync(&node) == -1);
+  assert(nr_pages == PCACHE_MAX_PAGES);
+
+  // Written back past the pinned page 0 to make room
+  writable = true;
+  assert(pcache_write(&node, index * PCACHE_PAGE_SIZE, page, 1) == 1);
+  assert(nr_writes == 1 && last_write == 1);
+  assert(nr_dirty == PCACHE_MAX_DIRTY);
+
+  pcache_drop(&node);
+  assert(nr_pages == 0 && nr_dirty == 0);
+  return true;
+}
+#endif
+
+void test_pcache() {
+#ifdef CFG_RUN_FS_PCACHE_TEST
+  unittest(test_pcache_read_write, "FS", "pcache - shared pages & sync");
+  unittest(test_pcache_evict, "FS", "pcache - LRU eviction & writeback");
+#endif
+}
@@ -2,16 +2,19 @@
 #include "fs/vfs.h"
 
 #include "dev/cpio.h"
+#include "dev/lz4.h"
 #include "minmax.h"
 #include "mm.h"
+#include "mm/frame.h"
+#include "spinlock.h"
 #include "stdint.h"
 #include "string.h"
 #include "uart.h"
 #include <stddef.h>
 
 #include "config.h"
-#include "fatal.h"
 #include "log.h"
+#include "test.h"
 
 #ifdef CFG_LOG_TMPFS
 static const int _DO_LOG = 1;
@@ -19,30 +22,54 @@ static const int _DO_LOG = 1;
 static const int _DO_LOG = 0;
 #endif
 
-// TODO: use linked-list to replace staticaly allocate space
-#define TMPFS_DIR_CAPACITY 10
+// Buckets of a new dir, doubled whenever entries outnumber them
+#define TMPFS_DIR_INIT_BUCKETS 8 // power of 2
 
 #define TMPFS_NODE_TYPE_DIR 1
 #define TMPFS_NODE_TYPE_FILE 2
 
-#define TMPFS_MX_FILE_NAME_LEN 256
+// File data is kept in pages of one frame
+#define TMPFS_PAGE_SHIFT FRAME_SHIFT
+#define TMPFS_PAGE_SIZE FRAME_SIZE
 
-// Private content for vnode in tmpfs
+/**
+ * Private content for vnode in tmpfs
+ *  A dir is a hash table of its children, chained through `hash_next` of the
+ *  child. For a dir, `size` counts the children and `capacity` the buckets.
+ *
+ *  A file is an array of `capacity` page pointers, pages are allocated on the
+ *  first write into them. Growing a file never moves its data, only the page
+ *  array is doubled when full.
+ *
+ *  A NULL page reads from `backing`, the read-only data the file starts with
+ *  (its payload in the initramfs, referenced in place), and as zeros past
+ *  `backing_size`. The first write into a page copies its backing data into
+ *  a private page (copy-on-write), the backing itself is never written.
+ * */
 typedef struct {
   char *name;
+  uint32_t name_hash; // component_hash of name
   uint8_t node_type;
   size_t size;
   size_t capacity;
 
+  // Next child in the same bucket of the parent dir
+  struct vnode *hash_next;
+
+  // Protect file data, while dir children are protected by the vfs tree lock
+  spinlock_t lock;
+
   // Differernt node could access differnt attribute
   union {
     // Dir node
     struct {
-      struct vnode **children;
+      struct vnode **buckets;
     };
     // File node
     struct {
-      char *data;
+      char **pages;
+      const char *backing;
+      size_t backing_size;
     };
   };
 } Content;
@@ -60,6 +87,9 @@ struct filesystem tmpfs = {
 /**
  * Because we build our CPIO by using `find .` command, this rebuild process
  * is just exploit some feauture of the `find` command's output
+ *
+ * An uncompressed initramfs is referenced in place, a LZ4 compressed one is
+ * decompressed while its headers are parsed, file data straight into pages.
  **/
 static void build_root_tree(struct vnode *root_dir);
 
@@ -74,19 +104,21 @@ static const char *node_name(struct vnode *dir) {
  *  means user need to build a vnode(with name $ret_name) under the returned
  *  parent vnode
  * @param fullpath fullpath of the file in CPIO filename. e.g., "./folder/a.txt"
- * @param ret_name buffer to write the component name.  e.g., "a.txt"
+ * @param ret_name return the last component, viewed inside fullpath. e.g.,
+ *  "a.txt"
  * @retval parent vnode of the target handle
  */
 static struct vnode *build_root_find_parent_dir(const char *fullpath,
                                                 struct vnode *root_dir,
-                                                char *ret_name);
+                                                struct component *ret_name);
 
 #ifdef CFG_LOG_TMPFS_DUMP_TREE
 static void tmpfs_dumpdir(struct vnode *dir_node, int cur_level);
 #endif
 
 // Create & Initialize a empty vnode for TMPFS
-static struct vnode *create_vnode(const char *name, uint8_t node_type);
+static struct vnode *create_vnode(const char *name, int len, uint8_t node_type,
+                                  struct vnode *parent);
 
 // Convert CPIO mode to TMPFS node_type
 static int parse_node_type(int64_t cpio_mode) {
@@ -111,27 +143,184 @@ int tmpfs_init() {
   return 0;
 }
 
-static struct vnode *create_vnode(const char *name, uint8_t node_type) {
+static struct vnode **alloc_buckets(size_t n) {
+  struct vnode **buckets = kalloc(sizeof(struct vnode *) * n);
+  for (size_t i = 0; i < n; i++) {
+    buckets[i] = NULL;
+  }
+  return buckets;
+}
+
+static inline struct vnode **dir_bucket(Content *dir, uint32_t hash) {
+  return &dir->buckets[hash & (dir->capacity - 1)];
+}
+
+// Double the buckets and relink every child in place
+static void dir_grow(Content *dir) {
+  struct vnode **old = dir->buckets, *node, *next, **bucket;
+  size_t old_capacity = dir->capacity;
+  dir->capacity = old_capacity << 1;
+  dir->buckets = alloc_buckets(dir->capacity);
+  for (size_t i = 0; i < old_capacity; i++) {
+    for (node = old[i]; node != NULL; node = next) {
+      Content *cnt = content_ptr(node);
+      next = cnt->hash_next;
+      bucket = dir_bucket(dir, cnt->name_hash);
+      cnt->hash_next = *bucket;
+      *bucket = node;
+    }
+  }
+  kfree(old);
+  log_println("[tmpfs] `%s`: grow to %d buckets", dir->name, dir->capacity);
+}
+
+// Link a child into a dir, keeping at most one child per bucket on average
+static void dir_add(struct vnode *dir_node, struct vnode *child) {
+  Content *dir = content_ptr(dir_node), *cnt = content_ptr(child);
+  struct vnode **bucket;
+  if (dir->size >= dir->capacity) {
+    dir_grow(dir);
+  }
+  bucket = dir_bucket(dir, cnt->name_hash);
+  cnt->hash_next = *bucket;
+  *bucket = child;
+  dir->size++;
+}
+
+// Make the page array hold at least `npages` pages
+static void file_reserve(Content *file, size_t npages) {
+  if (npages <= file->capacity) {
+    return;
+  }
+  size_t capacity = max(npages, file->capacity << 1);
+  char **pages = kalloc(sizeof(char *) * capacity);
+  for (size_t i = 0; i < capacity; i++) {
+    pages[i] = i < file->capacity ? file->pages[i] : NULL;
+  }
+  if (file->pages != NULL) {
+    kfree(file->pages);
+  }
+  file->pages = pages;
+  file->capacity = capacity;
+}
+
+// Copy [pos, pos + len) of the backing data, zeros past its end
+static void read_backing(Content *file, size_t pos, char *dst, size_t len) {
+  size_t n = 0;
+  if (pos < file->backing_size) {
+    n = min(len, file->backing_size - pos);
+    memcpy(dst, file->backing + pos, n);
+  }
+  for (; n < len; n++) {
+    dst[n] = 0;
+  }
+}
+
+static inline char *file_page(Content *file, size_t idx) {
+  return idx < file->capacity ? file->pages[idx] : NULL;
+}
+
+// Write into pages, allocating the missing ones, the caller holds file->lock
+static size_t file_write(Content *file, size_t pos, const void *buf,
+                         size_t len) {
+  const char *src = buf;
+  size_t end = pos + len, chunk, offset;
+  if (len == 0) {
+    return 0;
+  }
+  file_reserve(file, ((end - 1) >> TMPFS_PAGE_SHIFT) + 1);
+  for (; pos < end; pos += chunk, src += chunk) {
+    char **page = &file->pages[pos >> TMPFS_PAGE_SHIFT];
+    offset = pos & (TMPFS_PAGE_SIZE - 1);
+    chunk = min(TMPFS_PAGE_SIZE - offset, end - pos);
+    if (*page == NULL) {
+      *page = kalloc(TMPFS_PAGE_SIZE);
+      read_backing(file, pos - offset, *page, TMPFS_PAGE_SIZE);
+    }
+    memcpy(*page + offset, src, chunk);
+  }
+  file->size = max(end, file->size);
+  return len;
+}
+
+// Read from pages, holes read as zeros, the caller holds file->lock
+static size_t file_read(Content *file, size_t pos, void *buf, size_t len) {
+  char *dst = buf;
+  size_t start = pos, end, chunk, offset;
+  if (pos >= file->size) {
+    return 0;
+  }
+  end = min(pos + len, file->size);
+  for (; pos < end; pos += chunk, dst += chunk) {
+    char *page = file_page(file, pos >> TMPFS_PAGE_SHIFT);
+    offset = pos & (TMPFS_PAGE_SIZE - 1);
+    chunk = min(TMPFS_PAGE_SIZE - offset, end - pos);
+    if (page != NULL) {
+      memcpy(dst, page + offset, chunk);
+    } else {
+      read_backing(file, pos, dst, chunk);
+    }
+  }
+  return end - start;
+}
+
+// Fill an empty file with `len` bytes of an archive entry, page by page
+// @retval bytes filled, less than len if the archive ends early
+static size_t file_fill(Content *file, CpioStream *stream, size_t len) {
+  size_t want, n;
+  if (len == 0) {
+    return 0;
+  }
+  file_reserve(file, ((len - 1) >> TMPFS_PAGE_SHIFT) + 1);
+  for (size_t idx = 0; file->size < len; idx++) {
+    char *page = kalloc(TMPFS_PAGE_SIZE);
+    file->pages[idx] = page;
+    want = min((size_t)TMPFS_PAGE_SIZE, len - file->size);
+    n = cpioStreamRead(stream, page, want);
+    // Zeros past the end, as a page copied from the backing data
+    for (size_t i = n; i < TMPFS_PAGE_SIZE; i++) {
+      page[i] = 0;
+    }
+    file->size += n;
+    if (n < want) {
+      break;
+    }
+  }
+  return file->size;
+}
+
+static struct vnode *create_vnode(const char *name, int len, uint8_t node_type,
+                                  struct vnode *parent) {
   struct vnode *node = (struct vnode *)kalloc(sizeof(struct vnode));
 
   // This node is not mounted by other directory
   node->mnt = NULL;
+  node->parent = parent;
+  node->is_dir = node_type == TMPFS_NODE_TYPE_DIR;
   node->v_ops = tmpfs_v_ops;
   node->f_ops = tmpfs_f_ops;
+  // File data is in memory already
+  node->p_ops = NULL;
 
   Content *cnt = kalloc(sizeof(Content));
   {
-    cnt->name = (char *)kalloc(sizeof(char) * strlen(name));
-    strcpy(cnt->name, name);
+    cnt->name = (char *)kalloc(sizeof(char) * (len + 1));
+    memcpy(cnt->name, name, len);
+    cnt->name[len] = '\0';
+    cnt->name_hash = component_hash(name, len);
+    cnt->hash_next = NULL;
     cnt->node_type = node_type;
+    spin_lock_init(&cnt->lock, "tmpfs_node");
     if (node_type == TMPFS_NODE_TYPE_DIR) {
-      cnt->children = kalloc(sizeof(struct vnode *) * TMPFS_DIR_CAPACITY);
-      cnt->capacity = TMPFS_DIR_CAPACITY;
+      cnt->buckets = alloc_buckets(TMPFS_DIR_INIT_BUCKETS);
+      cnt->capacity = TMPFS_DIR_INIT_BUCKETS;
       cnt->size = 0;
 
       // lazy allocate
     } else if (node_type == TMPFS_NODE_TYPE_FILE) {
-      cnt->data = NULL;
+      cnt->pages = NULL;
+      cnt->backing = NULL;
+      cnt->backing_size = 0;
       cnt->capacity = 0;
       cnt->size = 0;
     }
@@ -142,34 +331,23 @@ static struct vnode *create_vnode(const char *name, uint8_t node_type) {
 
 static struct vnode *build_root_find_parent_dir(const char *fullpath,
                                                 struct vnode *root_dir,
-                                                char *ret_name) {
+                                                struct component *ret_name) {
 
   const char *cur_path;
   struct vnode *parent_dir, *child_node;
-  int start_idx, end_idx, name_size;
-  char *file_name = NULL;
+  int start_idx, end_idx;
 
   cur_path = fullpath;
   parent_dir = root_dir;
   // Most find path should return in this while loop
   while (0 == get_component(cur_path, &start_idx, &end_idx)) {
-    name_size = end_idx - start_idx + 1;
-    if (name_size >= TMPFS_MX_FILE_NAME_LEN) {
-      FATAL("Err: component name too large");
-    }
-    file_name = kalloc(sizeof(char) * (name_size + 1));
-    memcpy(file_name, &cur_path[start_idx], name_size);
-    file_name[name_size] = '\0';
-
-    if (tmpfs_lookup(parent_dir, &child_node, file_name) == 0 &&
+    component_init(ret_name, &cur_path[start_idx], end_idx - start_idx + 1);
+    if (tmpfs_lookup(parent_dir, &child_node, ret_name) == 0 &&
         child_node != NULL) {
       parent_dir = child_node;
       cur_path = &cur_path[end_idx + 1];
-      kfree(file_name);
     } else {
       // this is the component we want to build for
-      strcpy(ret_name, file_name);
-      kfree(file_name);
       return parent_dir;
     }
   }
@@ -177,63 +355,109 @@ static struct vnode *build_root_find_parent_dir(const char *fullpath,
   // The only reason we're not return yet is...
   // the fullpath is equal to '.'(we don't want to build this node)
   // So here we return a NULL to ask caller not building this node
-  ret_name[0] = '\0';
+  ret_name->len = 0;
   return NULL;
 }
 
-void build_root_tree(struct vnode *root_dir) {
-  CpioNewcHeader *next;
+// Create the vnode of an archive entry, NULL if it's skipped
+static struct vnode *build_root_add(struct vnode *root_dir, const char *path,
+                                    uint64_t mode) {
+  struct component component_name;
+  struct vnode *parent_dir, *child_node;
+  int node_type;
+
+  // Find the parent vnode of the target file to create
+  parent_dir = build_root_find_parent_dir(path, root_dir, &component_name);
+
+  // Do not build for child without parent
+  // example: the `.` under '/'
+  if (parent_dir == NULL) {
+    log_println("[tmpfs] cpio: skip creation for %s", path);
+    return NULL;
+  }
+
+  if (-1 == (node_type = parse_node_type(mode))) {
+    return NULL;
+  }
+  child_node = create_vnode(component_name.name, component_name.len,
+                            node_type, parent_dir);
+  dir_add(parent_dir, child_node);
+  log_println("[tmpfs] %s: create `%s` under `%s`", path,
+              node_name(child_node), node_name(parent_dir));
+  return child_node;
+}
+
+static void build_root_tree_cpio(struct vnode *root_dir) {
+  CpioNewcHeader *dir_header, *next;
   const char *path;
   void *fileContent;
-  int err;
   uint64_t mode, filesize;
   struct vnode *child_node;
-
   Content *node_content;
-  CpioNewcHeader *dir_header;
 
   dir_header = (CpioNewcHeader *)RAMFS_ADDR;
-
-  char component_name[TMPFS_MX_FILE_NAME_LEN];
-  int node_type;
-
-  struct vnode *parent_dir;
-  Content *parent_content;
-  log_println("[tmpfs] start building rootfs from CPIO archive");
-
   for (;; dir_header = next) {
-    if ((err = cpioParseHeader(dir_header, &path, &filesize, &mode,
-                               &fileContent, &next)) != 0) {
+    if (cpioParseHeader(dir_header, &path, &filesize, &mode, &fileContent,
+                        &next) != 0) {
       break;
     }
-    // Find the parent vnode of the target file to create
-    parent_dir = build_root_find_parent_dir(path, root_dir, component_name);
-
-    // Do not build for child without parent
-    // example: the `.` under '/'
-    if (parent_dir == NULL) {
-      log_println("[tmpfs] cpio: skip creation for %s", path);
+    child_node = build_root_add(root_dir, path, mode);
+    if (child_node == NULL) {
       continue;
     }
 
-    if (-1 == (node_type = parse_node_type(mode))) {
+    // Setup file content, referenced in place (the initramfs is reserved)
+    node_content = content_ptr(child_node);
+    if (node_content->node_type == TMPFS_NODE_TYPE_FILE) {
+      node_content->backing = fileContent;
+      node_content->backing_size = filesize;
+      node_content->size = filesize;
+    }
+  }
+}
+
+static size_t lz4_pull(void *stream, void *buf, size_t len) {
+  return lz4_read(stream, buf, len);
+}
+
+static void build_root_tree_lz4(struct vnode *root_dir) {
+  struct lz4_stream lz4;
+  CpioStream stream;
+  char path[VFS_PATH_MAX];
+  uint64_t mode, filesize;
+  struct vnode *child_node;
+  Content *node_content;
+  int err;
+
+  if (lz4_open(&lz4, (void *)RAMFS_ADDR) != 0) {
+    uart_println("[tmpfs] initramfs: unsupported LZ4 frame");
+    return;
+  }
+  cpioStreamInit(&stream, lz4_pull, &lz4);
+  while ((err = cpioStreamNext(&stream, path, sizeof(path), &filesize,
+                               &mode)) == 0) {
+    child_node = build_root_add(root_dir, path, mode);
+    if (child_node == NULL) {
       continue;
     }
-    child_node = create_vnode(component_name, node_type);
     node_content = content_ptr(child_node);
-    node_content->size = filesize;
-
-    // Setup file content
-    if (node_type == TMPFS_NODE_TYPE_FILE) {
-      node_content->data = kalloc(filesize);
-      memcpy(node_content->data, fileContent, filesize);
-      node_content->capacity = filesize;
+    if (node_content->node_type == TMPFS_NODE_TYPE_FILE &&
+        file_fill(node_content, &stream, filesize) != filesize) {
+      break;
     }
+  }
+  if (err != 1) {
+    uart_println("[tmpfs] initramfs: broken archive");
+  }
+  lz4_close(&lz4);
+}
 
-    parent_content = content_ptr(parent_dir);
-    parent_content->children[parent_content->size++] = child_node;
-    log_println("[tmpfs] %s: create `%s` under `%s`", path,
-                node_name(child_node), node_name(parent_dir));
+void build_root_tree(struct vnode *root_dir) {
+  log_println("[tmpfs] start building rootfs from CPIO archive");
+  if (lz4_is_frame((void *)RAMFS_ADDR)) {
+    build_root_tree_lz4(root_dir);
+  } else {
+    build_root_tree_cpio(root_dir);
   }
 #ifdef CFG_LOG_TMPFS_DUMP_TREE
   tmpfs_dumpdir(root_dir, 0);
@@ -247,7 +471,7 @@ int tmpfs_setup_mount(struct filesystem *fs, struct mount *mount) {
     tmpfs_initialized = true;
   }
 
-  struct vnode *root = create_vnode("/", TMPFS_NODE_TYPE_DIR);
+  struct vnode *root = create_vnode("/", 1, TMPFS_NODE_TYPE_DIR, NULL);
   build_root_tree(root);
 
   // Officially mount this root vnode onto the mount point
@@ -257,24 +481,11 @@ int tmpfs_setup_mount(struct filesystem *fs, struct mount *mount) {
 
 int tmpfs_write(struct file *f, const void *buf, unsigned long len) {
   Content *content = content_ptr(f->node);
-  size_t request_end = f->f_pos + len;
-
-  // Need to enlarge size
-  if (request_end > content->capacity) {
-    size_t new_size = request_end << 1;
-    log_println("[tmpfs] Enlarge file capacity from %d to %d",
-                content->capacity, new_size);
-    char *new_data = kalloc(sizeof(char) * new_size);
-    if (content->data != NULL) {
-      memcpy(new_data, content->data, content->size);
-      kfree(content->data);
-    }
-    content->data = new_data;
-    content->capacity = new_size;
-  }
-  memcpy(&content->data[f->f_pos], buf, len);
+
+  spin_lock(&content->lock);
+  len = file_write(content, f->f_pos, buf, len);
+  spin_unlock(&content->lock);
   f->f_pos += len;
-  content->size = max(request_end, content->size);
   log_println("[tmpfs] write: `%s`, len:%d", node_name(f->node), len);
   return len;
 }
@@ -282,23 +493,23 @@ int tmpfs_write(struct file *f, const void *buf, unsigned long len) {
 int tmpfs_read(struct file *f, void *buf, unsigned long len) {
   Content *content = content_ptr(f->node);
 
-  size_t request_end = f->f_pos + len;
-  size_t read_len = min(request_end, content->size) - f->f_pos;
+  spin_lock(&content->lock);
   log_println("[tmpfs] read: f_pos:%d, size:%d", f->f_pos, content->size);
-
-  memcpy(buf, &content->data[f->f_pos], read_len);
+  size_t read_len = file_read(content, f->f_pos, buf, len);
+  spin_unlock(&content->lock);
   f->f_pos += read_len;
   log_println("[tmpfs] read: `%s`, len:%d", node_name(f->node), read_len);
   return read_len;
 }
 
 int tmpfs_lookup(struct vnode *dir_node, struct vnode **target,
-                 const char *component_name) {
+                 const struct component *name) {
   Content *dir_content = content_ptr(dir_node);
 
 #ifdef CFG_LOG_TMPFS_LOOKUP
-  uart_println("%s[tmpfs] lookup: `%s` under folder: `%s`%s", LOG_DIM_START,
-               component_name, dir_content->name, LOG_DIM_END);
+  uart_printf("%s[tmpfs] lookup: `", LOG_DIM_START);
+  component_puts(name);
+  uart_println("` under folder: `%s`%s", dir_content->name, LOG_DIM_END);
 #endif
 
   // Check for current directory is neccessary because we would call this
@@ -306,20 +517,19 @@ int tmpfs_lookup(struct vnode *dir_node, struct vnode **target,
   // the vfs for resolving what '.' means.
 
   // "." means the current directory
-  if (strcmp(component_name, ".") == 0) {
+  if (component_eq(name, ".")) {
     *target = dir_node;
     return 0;
   }
 
   Content *child_content;
-  struct vnode *child_vnode;
-  for (int i = 0; i < dir_content->size; i++) {
-    child_vnode = dir_content->children[i];
+  struct vnode *child_vnode = *dir_bucket(dir_content, name->hash);
+  for (; child_vnode != NULL; child_vnode = child_content->hash_next) {
     child_content = content_ptr(child_vnode);
-    if (strcmp(child_content->name, component_name) == 0) {
+    if (child_content->name_hash == name->hash &&
+        component_eq(name, child_content->name)) {
       *target = child_vnode;
       return 0;
-      ;
     }
   }
   *target = NULL;
@@ -331,34 +541,33 @@ void tmpfs_dumpdir(struct vnode *dir_node, int cur_level) {
   Content *dir_content = content_ptr(dir_node);
   Content *child_content;
   struct vnode *child_vnode;
-  for (int i = 0; i < dir_content->size; i++) {
-    child_vnode = dir_content->children[i];
-    child_content = content_ptr(child_vnode);
-    for (int i = 0; i < cur_level; i++) {
-      uart_puts("  ");
-    }
-    uart_printf(" +- %s", child_content->name);
-    if (child_content->node_type == TMPFS_NODE_TYPE_FILE) {
-      uart_println(" (file)");
-    } else if (child_content->node_type == TMPFS_NODE_TYPE_DIR) {
-      uart_println(" (dir)");
-      tmpfs_dumpdir(child_vnode, cur_level + 1);
+  // In hash order
+  for (int b = 0; b < dir_content->capacity; b++) {
+    child_vnode = dir_content->buckets[b];
+    for (; child_vnode != NULL; child_vnode = child_content->hash_next) {
+      child_content = content_ptr(child_vnode);
+      for (int i = 0; i < cur_level; i++) {
+        uart_puts("  ");
+      }
+      uart_printf(" +- %s", child_content->name);
+      if (child_content->node_type == TMPFS_NODE_TYPE_FILE) {
+        uart_println(" (file)");
+      } else if (child_content->node_type == TMPFS_NODE_TYPE_DIR) {
+        uart_println(" (dir)");
+        tmpfs_dumpdir(child_vnode, cur_level + 1);
+      }
     }
   }
 }
 #endif
 
 int tmpfs_create(struct vnode *dir_node, struct vnode **target,
-                 const char *component_name) {
+                 const struct component *name) {
   struct vnode *child_node;
-  Content *child_content, *parent_content;
-
-  child_node = create_vnode(component_name, TMPFS_NODE_TYPE_FILE);
-  child_content = content_ptr(child_node);
-  child_content->size = 0;
 
-  parent_content = content_ptr(dir_node);
-  parent_content->children[parent_content->size++] = child_node;
+  child_node =
+      create_vnode(name->name, name->len, TMPFS_NODE_TYPE_FILE, dir_node);
+  dir_add(dir_node, child_node);
 
   log_println("[tmpfs] create `%s` under `%s`", node_name(child_node),
               node_name(dir_node));
@@ -368,3 +577,104 @@ int tmpfs_create(struct vnode *dir_node, struct vnode **target,
   }
   return 0;
 }
+
+#ifdef CFG_RUN_FS_TMPFS_TEST
+bool test_tmpfs_dir_grow() {
+  const int n = 100;
+  char name[3];
+  struct component c;
+  struct vnode *dir = create_vnode("dir", 3, TMPFS_NODE_TYPE_DIR, NULL);
+  struct vnode *child, *found;
+
+  // Way past the initial buckets
+  for (int i = 0; i < n; i++) {
+    name[0] = 'a' + i / 26;
+    name[1] = 'a' + i % 26;
+    component_init(&c, name, 2);
+    assert(tmpfs_create(dir, &child, &c) == 0);
+    assert(child->parent == dir);
+  }
+  Content *cnt = content_ptr(dir);
+  assert(cnt->size == n && cnt->capacity >= n);
+
+  for (int i = 0; i < n; i++) {
+    name[0] = 'a' + i / 26;
+    name[1] = 'a' + i % 26;
+    component_init(&c, name, 2);
+    assert(tmpfs_lookup(dir, &found, &c) == 0);
+    assert(component_eq(&c, node_name(found)));
+  }
+  component_init(&c, "zz", 2);
+  assert(tmpfs_lookup(dir, &found, &c) == -1 && found == NULL);
+  component_init(&c, "a", 1);
+  assert(tmpfs_lookup(dir, &found, &c) == -1);
+  return true;
+}
+
+bool test_tmpfs_file_pages() {
+  struct vnode *node = create_vnode("f", 1, TMPFS_NODE_TYPE_FILE, NULL);
+  Content *file = content_ptr(node);
+  char buf[16];
+  const size_t near_end = TMPFS_PAGE_SIZE - 4;
+
+  // Sparse: only the page holding the data is allocated
+  assert(file_write(file, 3 * TMPFS_PAGE_SIZE, "tail", 4) == 4);
+  assert(file->size == 3 * TMPFS_PAGE_SIZE + 4);
+  assert(file->pages[0] == NULL && file->pages[3] != NULL);
+  assert(file_read(file, 10, buf, 4) == 4);
+  assert(buf[0] == 0 && buf[3] == 0);
+
+  // Across a page boundary
+  assert(file_write(file, near_end, "abcdefgh", 8) == 8);
+  assert(file->pages[0] != NULL && file->pages[1] != NULL);
+  assert(file_read(file, near_end, buf, 8) == 8);
+  assert(strncmp(buf, "abcdefgh", 8) == 0);
+
+  // Append past the page array, earlier pages stay in place
+  char *first = file->pages[0];
+  assert(file_write(file, file->size, "0123456789", 10) == 10);
+  assert(file->pages[0] == first);
+  assert(file_read(file, 3 * TMPFS_PAGE_SIZE, buf, sizeof(buf)) == 14);
+  assert(strncmp(buf, "tail0123456789", 14) == 0);
+  assert(file_read(file, file->size, buf, 1) == 0);
+  return true;
+}
+
+bool test_tmpfs_file_backing() {
+  static char backing[TMPFS_PAGE_SIZE + 8];
+  struct vnode *node = create_vnode("f", 1, TMPFS_NODE_TYPE_FILE, NULL);
+  Content *file = content_ptr(node);
+  char buf[16];
+  backing[0] = 'a';
+  memcpy(&backing[TMPFS_PAGE_SIZE], "backing", 8);
+  file->backing = backing;
+  file->size = file->backing_size = sizeof(backing);
+
+  // Read in place, nothing allocated
+  assert(file_read(file, TMPFS_PAGE_SIZE, buf, sizeof(buf)) == 8);
+  assert(strcmp(buf, "backing") == 0);
+  assert(file->pages == NULL);
+
+  // Only the written page is copied, the backing stays as is
+  assert(file_write(file, TMPFS_PAGE_SIZE, "B", 1) == 1);
+  assert(file->pages[0] == NULL && file->pages[1] != NULL);
+  assert(backing[TMPFS_PAGE_SIZE] == 'b');
+  assert(file_read(file, TMPFS_PAGE_SIZE, buf, sizeof(buf)) == 8);
+  assert(strcmp(buf, "Backing") == 0);
+  assert(file_read(file, 0, buf, 1) == 1 && buf[0] == 'a');
+
+  // Growing past the backing reads zeros in between
+  assert(file_write(file, sizeof(backing) + 4, "x", 1) == 1);
+  assert(file_read(file, sizeof(backing), buf, 5) == 5);
+  assert(buf[0] == 0 && buf[3] == 0 && buf[4] == 'x');
+  return true;
+}
+#endif
+
+void test_tmpfs() {
+#ifdef CFG_RUN_FS_TMPFS_TEST
+  unittest(test_tmpfs_dir_grow, "FS", "tmpfs - growable hashed dir");
+  unittest(test_tmpfs_file_pages, "FS", "tmpfs - paged file data");
+  unittest(test_tmpfs_file_backing, "FS", "tmpfs - copy-on-write backing");
+#endif
+}
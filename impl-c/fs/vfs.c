@@ -1,6 +1,9 @@
 #include "fs/vfs.h"
+#include "fs/dcache.h"
+#include "fs/pagecache.h"
 
 #include "mm.h"
+#include "rwlock.h"
 #include "string.h"
 #include "uart.h"
 
@@ -23,6 +26,10 @@ static const int _DO_LOG = 0;
 
 struct mount *rootfs;
 
+// Protect the shape of the vnode tree (mount points and created nodes),
+// lookups only take the read side
+static rwlock_t vfs_tree_lock = RWLOCK_INIT("vfs_tree");
+
 #define __BUSY_WAIT                                                            \
   {                                                                            \
     while (1) {                                                                \
@@ -57,6 +64,8 @@ void vfs_init() {
   }
   rootfs->root = NULL;
   rootfs->fs = NULL;
+  dcache_init();
+  pcache_init();
 }
 
 int mount_root_fs(const char *fs_impl) {
@@ -87,8 +96,12 @@ int mount(struct vnode *node, const char *fs_impl) {
   struct mount *mnt = (struct mount *)kalloc(sizeof(struct mount));
   mnt->fs = target_fs;
   mnt->root = node;
+  target_fs->setup_mount(target_fs, mnt);
+  write_lock(&vfs_tree_lock);
+  // ".." from the mounted root leaves the mount
+  mnt->root->parent = node->parent;
   node->mnt = mnt;
-  target_fs->setup_mount(target_fs, node->mnt);
+  write_unlock(&vfs_tree_lock);
   log_println("[vfs][mount] mount device successfully");
   return 0;
 }
@@ -116,84 +129,120 @@ int register_filesystem(struct filesystem *fs) {
   return 0;
 }
 
-struct vnode *vfs_find_vnode(const char *pathname, bool creat_last) {
-  struct vnode *cwd = rootfs->root;
+void component_puts(const struct component *c) {
+  for (int i = 0; i < c->len; i++) {
+    uart_send(c->name[i]);
+  }
+}
+
+// Nothing is allocated while walking: components are viewed in place
+static struct vnode *__find_vnode(struct vnode *dir, const char *pathname,
+                                  bool creat_last) {
+  struct vnode *cwd;
 
   const char *path;
-  char *query_name;
-  int ret, start_idx, end_idx, name_size, lookup_result;
-  struct vnode *target_child;
+  struct component name;
+  int ret, start_idx, end_idx;
+  struct vnode *target_child = NULL;
 
+  if (pathname[0] == PATH_DELIM || dir == NULL) {
+    cwd = rootfs->root;
+  } else {
+    cwd = dir;
+  }
   path = pathname;
-  query_name = NULL;
   ret = start_idx = end_idx = -1;
   // Resolve the componenet name until reach the end
   for (; 0 == (ret = get_component(path, &start_idx, &end_idx));
-       query_name = NULL, start_idx = end_idx = -1) {
-
-    // Copy name
-    {
-      name_size = end_idx - start_idx + 1;
-      query_name = kalloc(name_size + 1);
-      memcpy(query_name, &path[start_idx], name_size);
-      query_name[name_size] = '\0';
-    }
-
-    log_println("find `%s`", query_name);
+       start_idx = end_idx = -1) {
+    component_init(&name, &path[start_idx], end_idx - start_idx + 1);
+    path = &path[end_idx + 1];
 
+    if (!cwd->is_dir) {
+      return NULL;
+    }
     // Query file by it's name
-    // "." means the current directory
-    if (strcmp(query_name, ".") == 0) {
+    // "." means the current directory, ".." the parent (stays at the root)
+    if (name.len == 1 && name.name[0] == '.') {
       target_child = cwd;
-      lookup_result = 0;
-    } else {
-      lookup_result = cwd->v_ops->lookup(cwd, &target_child, query_name);
+    } else if (name.len == 2 && name.name[0] == '.' && name.name[1] == '.') {
+      target_child = cwd->parent != NULL ? cwd->parent : cwd;
+    } else if (!dcache_lookup(cwd, &name, &target_child)) {
+      if (_DO_LOG) {
+        log_printf("find `");
+        component_puts(&name);
+        log_println("`");
+      }
+      if (cwd->v_ops->lookup(cwd, &target_child, &name) != 0) {
+        target_child = NULL;
+      }
+      dcache_insert(cwd, &name, target_child);
     }
 
     // Child found, go to the next level
-    if ((lookup_result == 0) && (target_child != NULL)) {
-      path = &path[end_idx + 1];
+    if (target_child != NULL) {
       // Effectivly swtich to the mounting child
       if (target_child->mnt != NULL) {
         cwd = target_child->mnt->root;
       } else {
         cwd = target_child;
       }
-      kfree(query_name);
       continue;
     }
 
     // Child not found, handle properly and return...
     // Get next component to makesure this is the final level
-    path = &path[end_idx + 1];
     ret = get_component(path, &start_idx, &end_idx);
     if (ret == 0) {
       // There're still component names not resolved, this is not the final
       // level
-      uart_println("Not existing middle pathname: `%s`", query_name);
-      kfree(query_name);
-      return NULL;
-    }
-    if (creat_last) {
-      ret = cwd->v_ops->create(cwd, &target_child, query_name);
-      kfree(query_name);
-      return (ret == 0) ? target_child : NULL;
-    } else {
-      kfree(query_name);
-      return NULL;
+      uart_println("Not existing middle pathname in: `%s`", pathname);
+    } else if (creat_last) {
+      if (cwd->v_ops->create(cwd, &target_child, &name) == 0) {
+        // Replace the negative entry
+        dcache_insert(cwd, &name, target_child);
+      } else {
+        target_child = NULL;
+      }
     }
+    return target_child;
+  }
+  // All resolved, a mount point is given as the root it's mounted with
+  return cwd;
+}
+
+struct vnode *vfs_find_vnode_at(struct vnode *dir, const char *pathname,
+                                bool creat_last) {
+  struct vnode *node;
+  // Creating the last component changes the tree
+  if (creat_last) {
+    write_lock(&vfs_tree_lock);
+    node = __find_vnode(dir, pathname, creat_last);
+    write_unlock(&vfs_tree_lock);
+  } else {
+    read_lock(&vfs_tree_lock);
+    node = __find_vnode(dir, pathname, creat_last);
+    read_unlock(&vfs_tree_lock);
   }
-  return target_child;
+  return node;
+}
+
+struct vnode *vfs_find_vnode(const char *pathname, bool creat_last) {
+  return vfs_find_vnode_at(NULL, pathname, creat_last);
 }
 
 struct file *vfs_open(const char *pathname, int flags) {
+  return vfs_open_at(NULL, pathname, flags);
+}
+
+struct file *vfs_open_at(struct vnode *dir, const char *pathname, int flags) {
 
   struct vnode *target;
   bool creat_last = false;
   if (flags & FILE_O_CREAT) {
     creat_last = true;
   }
-  target = vfs_find_vnode(pathname, creat_last);
+  target = vfs_find_vnode_at(dir, pathname, creat_last);
   if (target == NULL) {
     uart_println("[vfs] not found");
     return NULL;
@@ -209,8 +258,13 @@ struct file *vfs_open(const char *pathname, int flags) {
 }
 
 int vfs_close(struct file *file) {
+  int ret = 0;
+  // Data written through the page cache reaches the device here at the latest
+  if (file->node->p_ops != NULL) {
+    ret = pcache_sync(file->node);
+  }
   kfree(file);
-  return 0;
+  return ret;
 }
 
 int vfs_write(struct file *file, const void *buf, size_t len) {
@@ -259,6 +313,50 @@ get_cmpt_failed:
   return -1;
 }
 
+int vfs_path_join(char *dst, const char *cwd, const char *path, int size) {
+  const char *name;
+  int len = 0, name_size, start_idx, end_idx;
+  // dst holds no trailing delimiter while joining, so the root is empty
+  if (path[0] != PATH_DELIM) {
+    len = strlen(cwd);
+    if (len >= size) {
+      return -1;
+    }
+    memcpy(dst, cwd, len);
+    if (len == 1) {
+      len = 0;
+    }
+  }
+  for (; 0 == get_component(path, &start_idx, &end_idx);
+       path = &path[end_idx + 1]) {
+    name = &path[start_idx];
+    name_size = end_idx - start_idx + 1;
+    if (name_size == 1 && name[0] == '.') {
+      continue;
+    }
+    if (name_size == 2 && name[0] == '.' && name[1] == '.') {
+      while (len > 0 && dst[--len] != PATH_DELIM) {
+        ;
+      }
+      continue;
+    }
+    if (len + 1 + name_size >= size) {
+      return -1;
+    }
+    dst[len++] = PATH_DELIM;
+    memcpy(&dst[len], name, name_size);
+    len += name_size;
+  }
+  if (len == 0) {
+    if (size < 2) {
+      return -1;
+    }
+    dst[len++] = PATH_DELIM;
+  }
+  dst[len] = '\0';
+  return len;
+}
+
 #ifdef CFG_RUN_FS_VFS_TEST
 
 // input_data, expect answer
@@ -296,6 +394,45 @@ bool test_get_component_bad_input() {
   return true;
 }
 
+bool test_component_view() {
+  const char *path = "dev/sdcard";
+  struct component c;
+  component_init(&c, path, 3);
+  assert(component_eq(&c, "dev"));
+  assert(!component_eq(&c, "de"));
+  assert(!component_eq(&c, "devs"));
+  assert(c.hash == component_hash("dev", 3));
+  component_init(&c, &path[4], 6);
+  assert(component_eq(&c, "sdcard"));
+  return true;
+}
+
+#define RUN_JOIN_TEST(cwd, path, expect)                                       \
+  {                                                                            \
+    char _buf[32];                                                             \
+    int _ret = vfs_path_join(_buf, cwd, path, sizeof(_buf));                   \
+    if (_ret != strlen(expect) || strcmp(_buf, expect) != 0) {                 \
+      uart_println("cwd:%s path:%s -> %s(%s)", cwd, path,                      \
+                   _ret < 0 ? "<err>" : _buf, expect);                         \
+      return false;                                                            \
+    }                                                                          \
+  }
+
+bool test_path_join() {
+  RUN_JOIN_TEST("/", "dev", "/dev");
+  RUN_JOIN_TEST("/", "", "/");
+  RUN_JOIN_TEST("/dev", "sdcard/", "/dev/sdcard");
+  RUN_JOIN_TEST("/dev", "/etc//./a", "/etc/a");
+  RUN_JOIN_TEST("/dev/sdcard", "..", "/dev");
+  RUN_JOIN_TEST("/dev/sdcard", "../..", "/");
+  RUN_JOIN_TEST("/dev", "../../../a/./b/..", "/a");
+  // Does not fit
+  char buf[8];
+  assert(vfs_path_join(buf, "/", "abcdefgh", sizeof(buf)) == -1);
+  assert(vfs_path_join(buf, "/", "abcdef", sizeof(buf)) == 7);
+  return true;
+}
+
 #endif
 
 void test_vfs() {
@@ -304,5 +441,7 @@ void test_vfs() {
            "VFS - get component (good input)");
   unittest(test_get_component_bad_input, "FS",
            "VFS - get component (bad input)");
+  unittest(test_component_view, "FS", "VFS - component view");
+  unittest(test_path_join, "FS", "VFS - path join");
 #endif
 }
\ No newline at end of file
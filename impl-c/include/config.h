@@ -4,7 +4,7 @@
  *  Log
  * */
 
-#define CFG_LOG_SYSCALL
+// #define CFG_LOG_SYSCALL
 
 // #define CFG_LOG_CPIO
 // #define CFG_LOG_SHELL_SEARCH_FILE
@@ -18,12 +18,34 @@
 // #define CFG_LOG_PROC_SCHED
 // #define CFG_LOG_PROC_ARGV
 // #define CFG_LOG_PROC_EXEC
+// #define CFG_LOG_PROC_SMP
+// #define CFG_LOG_PROC_FPSIMD
 #define CFG_LOG_VFS
 // #define CFG_LOG_TMPFS
 #define CFG_LOG_TMPFS_LOOKUP
 #define CFG_LOG_TMPFS_DUMP_TREE
 #define CFG_LOG_DEV_MBR
+// #define CFG_LOG_DEV_LZ4
 #define CFG_LOG_FAT
+// #define CFG_LOG_PCACHE
+
+/**
+ *  Trace
+ * */
+// Record scheduler events into per-CPU rings (see include/proc/trace.h)
+// #define CFG_TRACE
+
+/**
+ *  Syscall
+ * */
+// Per-syscall latency histograms (see syscall_stats shell command)
+// #define CFG_SYSCALL_STATS
+
+/**
+ *  Lock
+ * */
+// Count acquisitions and contention of spinlocks (see spin_lock_report)
+// #define CFG_LOCK_STAT
 
 /**
  *  TEST
@@ -32,6 +54,7 @@
 
 // Libs
 #define CFG_RUN_LIB_STRING_TEST
+#define CFG_RUN_LIB_LOCK_TEST
 
 // Shell
 // #define CFG_RUN_SHELL_BUFFER_TEST
@@ -39,14 +62,22 @@
 
 // Memory management
 // #define CFG_RUN_STATUP_ALLOC_TEST
+#define CFG_RUN_MM_UACCESS_TEST
 
 // PROC
 // #define CFG_RUN_PROC_ARGV_TEST
+#define CFG_RUN_PROC_PID_TEST
+#define CFG_RUN_PROC_KTHREAD_TEST
 
 // DEV
 #define CFG_RUN_DEV_MBR_TEST
+#define CFG_RUN_DEV_CPIO_TEST
+#define CFG_RUN_DEV_LZ4_TEST
 
 // FS
 #define CFG_RUN_FS_VFS_TEST
+#define CFG_RUN_FS_DCACHE_TEST
+#define CFG_RUN_FS_PCACHE_TEST
+#define CFG_RUN_FS_TMPFS_TEST
 
 #define CFG_RUN_FS_FAT_TEST
\ No newline at end of file
@@ -29,6 +29,24 @@ typedef struct cpioNewcHeader {
   char check[8];
 } CpioNewcHeader;
 
+// Numeric fields of a newc header, in the order of CpioNewcHeader
+#define CPIO_NEWC_FIELDS 13
+enum cpioNewcField {
+  CPIO_FIELD_INO = 0,
+  CPIO_FIELD_MODE,
+  CPIO_FIELD_UID,
+  CPIO_FIELD_GID,
+  CPIO_FIELD_NLINK,
+  CPIO_FIELD_MTIME,
+  CPIO_FIELD_FILESIZE,
+  CPIO_FIELD_DEVMAJOR,
+  CPIO_FIELD_DEVMINOR,
+  CPIO_FIELD_RDEVMAJOR,
+  CPIO_FIELD_RDEVMINOR,
+  CPIO_FIELD_NAMESIZE,
+  CPIO_FIELD_CHECK,
+};
+
 // The Overview information of a cpio archive file
 typedef struct cpioSummaryInfo {
   unsigned int numFiles;
@@ -41,12 +59,64 @@ int cpioInfo(void *archive, CpioSummaryInfo *info);
 // Print file names inside a CPIO archive (using uart)
 int cpioLs(void *archive);
 
+// Get the size of a CPIO archive (up to the trailer), 0 if it's not valid
+unsigned long cpioArchiveSize(void *archive);
+
 // Get file by return it's content and the size in memory.
+// O(1) once the archive is indexed by cpioBuildIndex, a full scan otherwise
 void *cpioGetFile(void *archive, const char *name, unsigned long *size);
 
+/**
+ * @brief Index every entry of an archive by its path hash, so later
+ *  cpioGetFile calls on it don't parse headers. Only one archive is indexed,
+ *  a call replaces the previous index. Entries are referenced in place.
+ * @retval 0 for succeed, -1 if the archive is not valid
+ */
+int cpioBuildIndex(void *archive);
+
+/**
+ * @brief Decode all the hex fields of a header, 8 chars at a time (SWAR).
+ *  The header must be 2-byte aligned, as it is inside an archive loaded at
+ *  an aligned address (headers are 4-byte aligned).
+ * @param fields indexed by enum cpioNewcField
+ * @retval 0 for succeed, -1 if any field is not valid hex
+ */
+int cpioParseHeaderFields(const CpioNewcHeader *header,
+                          uint32_t fields[CPIO_NEWC_FIELDS]);
+
+/**
+ * Sequential reader of an archive which is not in memory as a whole, e.g.
+ * coming out of a decompressor. `read` pulls the next bytes of the archive
+ * (a NULL buf skips them) and returns how many it got.
+ */
+typedef struct cpioStream {
+  size_t (*read)(void *ctx, void *buf, size_t len);
+  void *ctx;
+  uint64_t offset; // bytes pulled so far, for the 4-byte padding
+  uint64_t remain; // data of the current entry not read yet
+} CpioStream;
+
+void cpioStreamInit(CpioStream *s, size_t (*read)(void *, void *, size_t),
+                    void *ctx);
+
+/**
+ * @brief Move to the next entry, skipping what's left of the current one
+ * @param name return the path of the entry, nameMax bytes at most (with NUL)
+ * @retval 0 for succeed, 1 at the trailer, -1 for a broken archive or a path
+ *  too long
+ */
+int cpioStreamNext(CpioStream *s, char *name, size_t nameMax,
+                   uint64_t *filesize, uint64_t *mode);
+
+// Read data of the current entry, return bytes read
+size_t cpioStreamRead(CpioStream *s, void *buf, size_t len);
+
 int cpioParseHeader(CpioNewcHeader *header, const char **filename,
                     uint64_t *_filesize, uint64_t *mode, void **data,
                     CpioNewcHeader **next);
 
 static inline bool s_ISFILE(uint64_t mode) { return (mode >> 12) == 8; }
-static inline bool s_ISDIR(uint64_t mode) { return (mode >> 12) == 4; }
\ No newline at end of file
+static inline bool s_ISDIR(uint64_t mode) { return (mode >> 12) == 4; }
+
+// Only used for running tests
+void test_cpio();
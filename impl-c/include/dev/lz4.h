@@ -0,0 +1,53 @@
+#pragma once
+
+#include "bool.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Streaming decoder of the LZ4 frame format
+ *  https://github.com/lz4/lz4/blob/dev/doc/lz4_Frame_format.md
+ *
+ *  Used to unpack a compressed initramfs: data is pulled by lz4_read, one
+ *  block is decoded at a time into a buffer of the frame's max block size
+ *  (64KB with `lz4 -B4`), so the whole archive never sits decompressed in
+ *  memory.
+ *
+ *  Only frames of independent blocks (the lz4 default) are supported.
+ *  Checksums are skipped, not verified.
+ * */
+
+#define LZ4_FRAME_MAGIC 0x184D2204
+
+struct lz4_stream {
+  const uint8_t *src; // next block of the frame
+  bool block_checksum;
+  bool content_checksum;
+  bool end; // EndMark reached, or a broken block
+
+  uint8_t *block; // buffer of decoded blocks
+  size_t block_max;
+  const uint8_t *data; // current block, in `block` or the frame if stored
+  size_t pos;          // next byte of the block to read
+  size_t len;          // size of the block
+};
+
+bool lz4_is_frame(const void *src);
+
+// Size of a frame, 0 if it's not valid. Block data is not decoded
+unsigned long lz4_frame_size(const void *src);
+
+// @retval 0 for succeed, -1 if the frame is not valid or not supported
+int lz4_open(struct lz4_stream *s, const void *src);
+
+/**
+ * @brief Read decompressed data, buf == NULL skips it
+ * @retval bytes read, less than len only at the end of the data or on a
+ *  broken block
+ */
+size_t lz4_read(struct lz4_stream *s, void *buf, size_t len);
+
+void lz4_close(struct lz4_stream *s);
+
+// Only used for running tests
+void test_lz4();
@@ -0,0 +1,9 @@
+#pragma once
+
+// Error numbers returned (negated) by syscalls, values follow Linux
+#define ENOENT 2        // No such file or directory
+#define EFAULT 14       // Bad address
+#define ENOTDIR 20      // Not a directory
+#define ERANGE 34       // Result too large
+#define ENAMETOOLONG 36 // File name too long
+#define ENOSYS 38       // Function not implemented
@@ -12,4 +12,20 @@
  */
 struct trap_frame {
   uint64_t regs[32];
-};
\ No newline at end of file
+};
+
+// Mask IRQ on the current core, return the previous interrupt mask (DAIF)
+static inline unsigned long irq_save() {
+  unsigned long flags;
+  asm volatile("mrs %0, daif      \n"
+               "msr daifset, #2   \n"
+               : "=r"(flags)
+               :
+               : "memory");
+  return flags;
+}
+
+// Restore the interrupt mask returned by irq_save
+static inline void irq_restore(unsigned long flags) {
+  asm volatile("msr daif, %0 \n" ::"r"(flags) : "memory");
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "bool.h"
+#include "fs/vfs.h"
+#include <stdint.h>
+
+/**
+ * Dentry cache
+ *  Remember the result of `v_ops->lookup` for a (parent dir, name) pair, so
+ *  walking a path already seen costs one hash probe per component instead of
+ *  a linear scan of every directory on the way.
+ *
+ *  A dentry with node == NULL is a negative entry: the name is known not to
+ *  exist under the parent, which also saves the scan on repeated misses.
+ *
+ *  Entries come from a static pool and are recycled in LRU order, the cache
+ *  never allocates memory. Vnodes are never freed, so a cached vnode pointer
+ *  stays valid; creating a child overwrites its negative entry.
+ *
+ *  Only names up to DNAME_MAX bytes are cached, longer ones always go to the
+ *  filesystem.
+ * */
+
+#define DCACHE_SIZE 256    // dentries in the pool
+#define DCACHE_BUCKETS 128 // power of 2
+#define DNAME_MAX 31
+
+struct dentry {
+  struct list_head lru;  // on the LRU list, least recently used first
+  struct list_head hash; // on a hash bucket, or empty when unused
+  struct vnode *parent;
+  struct vnode *node; // NULL for a negative entry
+  uint32_t name_hash;
+  uint8_t len;
+  char name[DNAME_MAX + 1];
+};
+
+void dcache_init();
+
+/**
+ * @brief Find a cached lookup result
+ * @param node return the child vnode, NULL for a negative entry
+ * @retval true if the name is cached under parent
+ */
+bool dcache_lookup(struct vnode *parent, const struct component *name,
+                   struct vnode **node);
+
+// Cache the lookup result of a name, node == NULL records a negative entry
+void dcache_insert(struct vnode *parent, const struct component *name,
+                   struct vnode *node);
+
+// Only used for running tests
+void test_dcache();
@@ -10,9 +10,9 @@ int fat_setup_mount(struct filesystem *fs, struct mount *mount);
 int fat_write(struct file *f, const void *buf, unsigned long len);
 int fat_read(struct file *f, void *buf, unsigned long len);
 int fat_lookup(struct vnode *dir_node, struct vnode **target,
-               const char *component_name);
+               const struct component *name);
 int fat_create(struct vnode *dir_node, struct vnode **target,
-               const char *component_name);
+               const struct component *name);
 
 extern struct filesystem fat;
 
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "bool.h"
+#include "fs/vfs.h"
+#include "list.h"
+#include "mm/frame.h"
+#include <stddef.h>
+
+/**
+ * Page cache
+ *  File data of block-backed filesystems, cached in pages keyed by
+ *  (vnode, page index). Every file handle of a vnode shares its pages.
+ *
+ *  A filesystem provides `p_ops` in its vnodes: `readpage` fills a page from
+ *  the device on a miss, `writepage` stores a dirty page back. Writes only
+ *  dirty the cached page, it reaches the device once the page is evicted or
+ *  synced.
+ *
+ *  At most PCACHE_MAX_PAGES pages are kept, a miss beyond that recycles the
+ *  least recently used page, writing it back first if dirty. A dirty page
+ *  whose writeback fails (e.g. no block backs it yet) is never evicted, its
+ *  data only lives here. At most PCACHE_MAX_DIRTY pages are dirty: a write
+ *  past that writes back older pages first, and is cut short if none could
+ *  be, so such pages never take over the cache.
+ * */
+
+#define PCACHE_PAGE_SHIFT FRAME_SHIFT
+#define PCACHE_PAGE_SIZE FRAME_SIZE
+#define PCACHE_MAX_PAGES 256 // 1MB
+#define PCACHE_MAX_DIRTY 64  // 256KB, less than PCACHE_MAX_PAGES
+#define PCACHE_BUCKETS 128   // power of 2
+
+struct cached_page {
+  struct list_head lru;  // on the LRU list, least recently used first
+  struct list_head hash; // on a hash bucket
+  struct vnode *node;
+  size_t index; // page index inside the file
+  bool dirty;
+  char *data; // PCACHE_PAGE_SIZE bytes
+};
+
+void pcache_init();
+
+/**
+ * @brief Read file data through the cache, filling missing pages by readpage.
+ *  The caller bounds the range by the file size.
+ * @retval bytes read, less than len if a page could not be filled
+ */
+size_t pcache_read(struct vnode *node, size_t pos, void *buf, size_t len);
+
+/**
+ * @brief Write file data into the cache, pages are marked dirty. A page only
+ *  partly written is filled by readpage first.
+ * @retval bytes written, less than len if a page could not be filled or the
+ *  dirty limit is reached
+ */
+size_t pcache_write(struct vnode *node, size_t pos, const void *buf,
+                    size_t len);
+
+// Write back dirty pages of a vnode (every vnode if NULL)
+// @retval 0 for succeed, -1 if any page could not be written back
+int pcache_sync(struct vnode *node);
+
+// Write back and release all pages of a vnode, those failed to write back
+// are dropped as well
+void pcache_drop(struct vnode *node);
+
+// Only used for running tests
+void test_pcache();
@@ -12,10 +12,13 @@ int tmpfs_init();
 int tmpfs_write(struct file *f, const void *buf, unsigned long len);
 int tmpfs_read(struct file *f, void *buf, unsigned long len);
 int tmpfs_lookup(struct vnode *dir_node, struct vnode **target,
-                 const char *component_name);
+                 const struct component *name);
 int tmpfs_create(struct vnode *dir_node, struct vnode **target,
-                 const char *component_name);
+                 const struct component *name);
 
 int tmpfs_setup_mount(struct filesystem *fs, struct mount *mount);
 
-extern struct filesystem tmpfs;
\ No newline at end of file
+extern struct filesystem tmpfs;
+
+// Only used for running tests
+void test_tmpfs();
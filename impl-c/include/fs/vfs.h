@@ -1,14 +1,58 @@
 #pragma once
+#include "bool.h"
 #include "list.h"
+#include "string.h"
 #include <stddef.h>
+#include <stdint.h>
+
+/**
+ * A path component viewed in place inside the path being resolved, so
+ * walking a path never copies a name. `name` is NOT NUL terminated.
+ * */
+struct component {
+  const char *name;
+  int len;
+  uint32_t hash; // component_hash(name, len)
+};
+
+// FNV-1a
+static inline uint32_t component_hash(const char *name, int len) {
+  uint32_t h = 2166136261u;
+  for (int i = 0; i < len; i++) {
+    h = (h ^ (uint8_t)name[i]) * 16777619u;
+  }
+  return h;
+}
+
+static inline void component_init(struct component *c, const char *name,
+                                  int len) {
+  c->name = name;
+  c->len = len;
+  c->hash = component_hash(name, len);
+}
+
+// Compare with a NUL terminated name
+static inline bool component_eq(const struct component *c, const char *s) {
+  return strncmp(s, c->name, c->len) == 0 && s[c->len] == '\0';
+}
+
+// Print a component to uart (for logging)
+void component_puts(const struct component *c);
 /**
  * A vnode could be mounted by another vnode with whole diffrent file system
  * tree, if mnt!=NULL, this vnode is mounted
+ *
+ * `parent` is the directory holding the vnode and resolves "..". The root of
+ * a mounted filesystem takes the parent of its mount point, so ".." leaves
+ * the mount. Vnodes are never freed, so these links stay valid.
  * */
 struct vnode {
   struct mount *mnt;
+  struct vnode *parent; // NULL for the root of the whole tree
+  bool is_dir;
   struct vnode_operations *v_ops;
   struct file_operations *f_ops;
+  struct page_cache_operations *p_ops; // NULL if data is not page cached
   void *internal;
 };
 
@@ -39,11 +83,18 @@ struct file_operations {
   int (*read)(struct file *f, void *buf, unsigned long len);
 };
 
+// Move file data between the device and the page cache (see fs/pagecache.h)
+// @retval 0 for succeed
+struct page_cache_operations {
+  int (*readpage)(struct vnode *node, size_t index, char *page);
+  int (*writepage)(struct vnode *node, size_t index, const char *page);
+};
+
 struct vnode_operations {
   int (*lookup)(struct vnode *dir_node, struct vnode **target,
-                const char *component_name);
+                const struct component *name);
   int (*create)(struct vnode *dir_node, struct vnode **target,
-                const char *component_name);
+                const struct component *name);
 };
 
 /**
@@ -65,7 +116,12 @@ int register_filesystem(struct filesystem *fs);
 // 3. Create a new file if O_CREAT is specified in flags.
 struct file *vfs_open(const char *pathname, int flags);
 
-// 1. release the file descriptor
+// Same as vfs_open, relative paths start from `dir` (the root if NULL)
+struct file *vfs_open_at(struct vnode *dir, const char *pathname, int flags);
+
+// 1. write back the file's dirty cached pages.
+// 2. release the file descriptor.
+// 3. return -1 if any page could not be written back, 0 otherwise.
 int vfs_close(struct file *file);
 
 // 1. write len byte from buf to the opened file.
@@ -83,6 +139,9 @@ void test_vfs();
 
 #define FILE_O_CREAT (1 << 0)
 
+// Longest path (with NUL) accepted from user space
+#define VFS_PATH_MAX 256
+
 /**
  * @brief Get the first component name by returning it's start/end index pair in
  * `path`
@@ -100,3 +159,15 @@ int get_component(const char *path, /* Return*/ int *start_idx,
  * @param creat_last create a vnode for the last component if not found
  */
 struct vnode *vfs_find_vnode(const char *pathname, bool creat_last);
+
+// Same as vfs_find_vnode, relative paths start from `dir` (the root if NULL)
+struct vnode *vfs_find_vnode_at(struct vnode *dir, const char *pathname,
+                                bool creat_last);
+
+/**
+ * @brief Resolve `path` against the absolute directory `cwd` by name only,
+ *  "." and ".." are folded away (no symlinks, so it matches the vnode walk)
+ * @param dst buffer of `size` bytes for the result, e.g., "/dev/sdcard"
+ * @retval length of the result, -1 if it does not fit in `size`
+ */
+int vfs_path_join(char *dst, const char *cwd, const char *path, int size);
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Atomic counters
+ *  Read-modify-write on a single word with the exclusive monitor
+ *  (ldaxr/stlxr), fully ordered like the spinlock acquire/release pair.
+ * */
+
+typedef struct {
+  volatile int32_t counter;
+} atomic_t;
+
+#define ATOMIC_INIT(i)                                                         \
+  { .counter = (i) }
+
+static inline int32_t atomic_read(atomic_t *v) { return v->counter; }
+
+static inline void atomic_set(atomic_t *v, int32_t i) { v->counter = i; }
+
+// @retval the new value
+static inline int32_t atomic_add_return(atomic_t *v, int32_t i) {
+  int32_t result;
+  uint32_t tmp;
+  asm volatile("1: ldaxr %w0, [%2]      \n"
+               "   add   %w0, %w0, %w3  \n"
+               "   stlxr %w1, %w0, [%2] \n"
+               "   cbnz  %w1, 1b        \n"
+               : "=&r"(result), "=&r"(tmp)
+               : "r"(&v->counter), "r"(i)
+               : "memory");
+  return result;
+}
+
+static inline int32_t atomic_sub_return(atomic_t *v, int32_t i) {
+  return atomic_add_return(v, -i);
+}
+
+static inline void atomic_inc(atomic_t *v) { atomic_add_return(v, 1); }
+
+static inline void atomic_dec(atomic_t *v) { atomic_add_return(v, -1); }
+
+// @retval true if the counter drops to zero
+static inline int atomic_dec_and_test(atomic_t *v) {
+  return atomic_add_return(v, -1) == 0;
+}
+
+/**
+ * @brief Store `new` if the counter equals `old`
+ * @retval the value before the operation, the store succeeded if it equals to
+ * `old`
+ */
+static inline int32_t atomic_cmpxchg(atomic_t *v, int32_t old, int32_t new) {
+  int32_t prev;
+  uint32_t tmp;
+  asm volatile("1: ldaxr %w0, [%2]      \n"
+               "   cmp   %w0, %w3       \n"
+               "   b.ne  2f             \n"
+               "   stlxr %w1, %w4, [%2] \n"
+               "   cbnz  %w1, 1b        \n"
+               "   b     3f             \n"
+               "2: clrex                \n"
+               "3:                      \n"
+               : "=&r"(prev), "=&r"(tmp)
+               : "r"(&v->counter), "r"(old), "r"(new)
+               : "memory", "cc");
+  return prev;
+}
+
+// Full memory barrier between cores
+#define smp_mb() asm volatile("dmb ish \n" ::: "memory")
@@ -19,6 +19,10 @@ typedef struct list_head {
   struct list_head *prev, *next;
 } list_head_t;
 
+// Get the struct containing a list_head which is not the first member
+#define list_entry(ptr, type, member)                                          \
+  ((type *)((char *)(ptr)-offsetof(type, member)))
+
 // Push a node to the back of a list
 static inline void list_push(struct list_head *entry, struct list_head *list) {
   entry->prev = list->prev;
@@ -0,0 +1,110 @@
+#pragma once
+
+#include "bool.h"
+#include "exception.h"
+#include <stdint.h>
+
+/**
+ * Reader-writer spinlock
+ *  Any number of readers, or a single writer. The lock word holds the number
+ *  of readers, with RWLOCK_WRITER set while a writer owns the lock.
+ *  Readers never block each other, which suits trees that are mostly looked up
+ *  (e.g. the VFS tree).
+ *
+ * Caution: a writer could starve under a steady stream of readers.
+ * */
+
+#define RWLOCK_WRITER 0x80000000
+
+typedef struct rwlock {
+  volatile uint32_t lock;
+  const char *name;
+} rwlock_t;
+
+#define RWLOCK_INIT(_name)                                                     \
+  { .lock = 0, .name = (_name) }
+
+static inline void rwlock_init(rwlock_t *rw, const char *name) {
+  rw->lock = 0;
+  rw->name = name;
+}
+
+static inline void read_lock(rwlock_t *rw) {
+  uint32_t val, tmp;
+  asm volatile("   sevl                 \n"
+               "1: wfe                  \n"
+               "2: ldaxr %w0, [%2]      \n"
+               "   tbnz  %w0, #31, 1b   \n"
+               "   add   %w0, %w0, #1   \n"
+               "   stxr  %w1, %w0, [%2] \n"
+               "   cbnz  %w1, 2b        \n"
+               : "=&r"(val), "=&r"(tmp)
+               : "r"(&rw->lock)
+               : "memory");
+}
+
+static inline void read_unlock(rwlock_t *rw) {
+  uint32_t val, tmp;
+  asm volatile("1: ldxr  %w0, [%2]      \n"
+               "   sub   %w0, %w0, #1   \n"
+               "   stlxr %w1, %w0, [%2] \n"
+               "   cbnz  %w1, 1b        \n"
+               : "=&r"(val), "=&r"(tmp)
+               : "r"(&rw->lock)
+               : "memory");
+}
+
+static inline void write_lock(rwlock_t *rw) {
+  uint32_t val, tmp;
+  asm volatile("   sevl                 \n"
+               "1: wfe                  \n"
+               "2: ldaxr %w0, [%2]      \n"
+               "   cbnz  %w0, 1b        \n"
+               "   stxr  %w1, %w3, [%2] \n"
+               "   cbnz  %w1, 2b        \n"
+               : "=&r"(val), "=&r"(tmp)
+               : "r"(&rw->lock), "r"(RWLOCK_WRITER)
+               : "memory");
+}
+
+static inline void write_unlock(rwlock_t *rw) {
+  asm volatile("stlr wzr, [%0] \n" ::"r"(&rw->lock) : "memory");
+}
+
+// @retval true if the lock is acquired
+static inline bool write_trylock(rwlock_t *rw) {
+  uint32_t val, tmp;
+  asm volatile("   ldaxr %w0, [%2]      \n"
+               "   cbnz  %w0, 1f        \n"
+               "   stxr  %w1, %w3, [%2] \n"
+               "   b     2f             \n"
+               "1: clrex                \n"
+               "   mov   %w1, #1        \n"
+               "2:                      \n"
+               : "=&r"(val), "=&r"(tmp)
+               : "r"(&rw->lock), "r"(RWLOCK_WRITER)
+               : "memory");
+  return tmp == 0;
+}
+
+static inline unsigned long read_lock_irqsave(rwlock_t *rw) {
+  unsigned long flags = irq_save();
+  read_lock(rw);
+  return flags;
+}
+
+static inline void read_unlock_irqrestore(rwlock_t *rw, unsigned long flags) {
+  read_unlock(rw);
+  irq_restore(flags);
+}
+
+static inline unsigned long write_lock_irqsave(rwlock_t *rw) {
+  unsigned long flags = irq_save();
+  write_lock(rw);
+  return flags;
+}
+
+static inline void write_unlock_irqrestore(rwlock_t *rw, unsigned long flags) {
+  write_unlock(rw);
+  irq_restore(flags);
+}
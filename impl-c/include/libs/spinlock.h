@@ -0,0 +1,141 @@
+#pragma once
+
+#include "bool.h"
+#include "config.h"
+#include "exception.h"
+#include <stdint.h>
+
+/**
+ * Ticket spinlock
+ *  Busy-waiting lock shared between cores, built on the exclusive monitor
+ *  (ldaxr/stxr). A core takes a ticket by incrementing `next`, and owns the
+ *  lock once `owner` reaches its ticket, so cores are served in FIFO order.
+ *  Waiters sleep in `wfe` and are woken up by the `stlrh` in spin_unlock,
+ *  which clears the exclusive monitor of every waiting core.
+ *
+ * Caution: spin_lock does not mask interrupts, use the irqsave variants for
+ * locks also taken inside an interrupt handler.
+ * */
+
+// Enabled with CFG_LOCK_STAT, reported by spin_lock_report
+struct lock_stat {
+  uint32_t acquired;  // number of acquisitions
+  uint32_t contended; // acquisitions which had to wait for another core
+};
+
+typedef struct spinlock {
+  // Layout must match the asm below: owner at the lower half
+  volatile uint16_t owner;
+  volatile uint16_t next;
+  const char *name;
+#ifdef CFG_LOCK_STAT
+  struct lock_stat stat;
+#endif
+} spinlock_t;
+
+#define SPINLOCK_TICKET_SHIFT 16
+
+#define SPINLOCK_INIT(_name)                                                   \
+  { .owner = 0, .next = 0, .name = (_name) }
+
+static inline void spin_lock_init(spinlock_t *lock, const char *name) {
+  lock->owner = 0;
+  lock->next = 0;
+  lock->name = name;
+#ifdef CFG_LOCK_STAT
+  lock->stat.acquired = 0;
+  lock->stat.contended = 0;
+#endif
+}
+
+// Take a ticket, return the lock value before taking it
+static inline uint32_t __spin_take_ticket(spinlock_t *lock) {
+  uint32_t lockval, newval, tmp;
+  asm volatile("1: ldaxr %w0, [%3]      \n"
+               "   add   %w1, %w0, %w4  \n"
+               "   stxr  %w2, %w1, [%3] \n"
+               "   cbnz  %w2, 1b        \n"
+               : "=&r"(lockval), "=&r"(newval), "=&r"(tmp)
+               : "r"(lock), "r"(1 << SPINLOCK_TICKET_SHIFT)
+               : "memory");
+  return lockval;
+}
+
+// Wait until `owner` reaches the ticket
+static inline void __spin_wait_ticket(spinlock_t *lock, uint16_t ticket) {
+  uint32_t owner;
+  asm volatile("   sevl                \n"
+               "1: wfe                 \n"
+               "   ldaxrh %w0, [%1]    \n"
+               "   cmp    %w0, %w2     \n"
+               "   b.ne   1b           \n"
+               : "=&r"(owner)
+               : "r"(&lock->owner), "r"((uint32_t)ticket)
+               : "memory", "cc");
+}
+
+static inline void spin_lock(spinlock_t *lock) {
+  uint32_t lockval = __spin_take_ticket(lock);
+  uint16_t ticket = lockval >> SPINLOCK_TICKET_SHIFT;
+  bool contended = ticket != (uint16_t)lockval;
+  if (contended) {
+    __spin_wait_ticket(lock, ticket);
+  }
+#ifdef CFG_LOCK_STAT
+  // Safe to update, we're holding the lock
+  lock->stat.acquired++;
+  lock->stat.contended += contended;
+#endif
+}
+
+// @retval true if the lock is acquired
+static inline bool spin_trylock(spinlock_t *lock) {
+  uint32_t lockval, tmp;
+  asm volatile("   ldaxr %w0, [%2]      \n"
+               "   eor   %w1, %w0, %w0, ror #16 \n"
+               "   cbnz  %w1, 2f        \n"
+               "   add   %w0, %w0, %w3  \n"
+               "   stxr  %w1, %w0, [%2] \n"
+               "   b     3f             \n"
+               "2: clrex                \n"
+               "   mov   %w1, #1        \n"
+               "3:                      \n"
+               : "=&r"(lockval), "=&r"(tmp)
+               : "r"(lock), "r"(1 << SPINLOCK_TICKET_SHIFT)
+               : "memory");
+#ifdef CFG_LOCK_STAT
+  if (tmp == 0) {
+    lock->stat.acquired++;
+  }
+#endif
+  return tmp == 0;
+}
+
+static inline void spin_unlock(spinlock_t *lock) {
+  uint16_t owner = lock->owner + 1;
+  asm volatile("stlrh %w1, [%0] \n" ::"r"(&lock->owner), "r"(owner)
+               : "memory");
+}
+
+static inline bool spin_is_locked(spinlock_t *lock) {
+  return lock->owner != lock->next;
+}
+
+// Interrupt safe variants: mask IRQ on this core while holding the lock
+static inline unsigned long spin_lock_irqsave(spinlock_t *lock) {
+  unsigned long flags = irq_save();
+  spin_lock(lock);
+  return flags;
+}
+
+static inline void spin_unlock_irqrestore(spinlock_t *lock,
+                                          unsigned long flags) {
+  spin_unlock(lock);
+  irq_restore(flags);
+}
+
+// Print contention counters of a lock (requires CFG_LOCK_STAT)
+void spin_lock_report(spinlock_t *lock);
+
+// Only used for running tests
+void test_lock();
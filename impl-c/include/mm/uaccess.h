@@ -0,0 +1,46 @@
+#pragma once
+
+#include "bool.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * User memory access
+ *  Without an MMU, user space of a task is the memory it has been given: its
+ *  program image and its user stack. Pointers passed by a user task are
+ *  checked against these regions before the kernel touches them.
+ *
+ *  A task without user space (a kernel thread calling exec_user, or running
+ *  a syscall handler directly) passes kernel pointers, which are trusted.
+ *
+ *  User buffers stay valid for the whole syscall (only the task itself could
+ *  free them by exec/exit), so large reads/writes don't need a bounce buffer:
+ *  check the range with access_ok and pass the user pointer down (zero-copy).
+ * */
+
+// @retval true if [addr, addr + size) is user memory of the current task
+bool access_ok(const void *addr, size_t size);
+
+// @retval 0 on success, -EFAULT if the user range is not accessible
+int copy_from_user(void *to, const void *from, size_t n);
+int copy_to_user(void *to, const void *from, size_t n);
+
+/**
+ * @brief Copy a NUL terminated string from user space
+ * @retval length of the string (without NUL), `count` if it's truncated
+ *  (dst is not terminated then), -EFAULT if the string is not accessible
+ */
+long strncpy_from_user(char *dst, const char *src, long count);
+
+/**
+ * @brief Get the size of a NUL terminated string in user space
+ * @retval length including the NUL, `count + 1` if longer than count,
+ *  0 if the string is not accessible
+ */
+long strnlen_user(const char *s, long count);
+
+// Copy word by word when both ends are aligned
+void copy_words(void *to, const void *from, size_t n);
+
+// Only used for running tests
+void test_uaccess();
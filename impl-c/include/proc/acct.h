@@ -0,0 +1,55 @@
+#pragma once
+
+#include "bool.h"
+#include <stdint.h>
+
+/**
+ * Per-task CPU accounting
+ *  Time is charged in cntpct_el0 ticks at every boundary a task crosses:
+ *  entering the kernel from EL0 closes a user slice, returning to EL0 or
+ *  being switched out closes a kernel slice. `acct_stamp` of the running task
+ *  always holds the start of the current slice.
+ *
+ *  A switch is voluntary if the task gave up the core because it's blocked
+ *  or exited, involuntary if it's still runnable (yield, migration).
+ * */
+
+struct task_struct;
+
+struct task_rusage {
+  uint64_t utime;      // ticks spent in EL0
+  uint64_t stime;      // ticks spent in EL1
+  uint64_t nvcsw;      // voluntary context switches
+  uint64_t nivcsw;     // involuntary context switches
+  uint64_t nsyscalls;  // number of syscalls
+};
+
+// Exposed to user space by sys_getrusage
+#define RUSAGE_SELF 0
+#define RUSAGE_CHILDREN -1 // children reaped by waitpid
+
+struct rusage {
+  uint64_t utime_us;
+  uint64_t stime_us;
+  uint64_t nvcsw;
+  uint64_t nivcsw;
+  uint64_t nsyscalls;
+};
+
+void acct_task_init(struct task_struct *task);
+
+// Exception taken from EL0, close the user slice of the current task
+void acct_enter_kernel();
+
+// About to return to EL0, close the kernel slice of the current task
+void acct_exit_kernel();
+
+// Called right before switching from prev to next
+void acct_switch(struct task_struct *prev, struct task_struct *next,
+                 bool voluntary);
+
+// Add usage of a reaped child into its parent
+void acct_reap(struct task_struct *parent, struct task_struct *child);
+
+// Print usage of all tasks, most CPU consuming first
+void acct_show_top();
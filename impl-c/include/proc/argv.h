@@ -2,19 +2,55 @@
 
 #include <stdint.h>
 
+// Limits of argv/envp accepted by exec/spawn
+#define ARGV_MAX 32 // each of argv and envp
+#define ARGV_STR_MAX 256
+
+// Auxiliary vector types (values follow Linux)
+#define AT_NULL 0
+#define AT_PAGESZ 6
+#define AT_ENTRY 9
+#define AT_HWCAP 16
+
+// AT_HWCAP bits
+#define HWCAP_FP (1 << 0)
+#define HWCAP_ASIMD (1 << 1)
+
+// Number of (type, value) pairs placed by place_args, AT_NULL included
+#define AUXV_NR 4
+
+// Where place_args put things, all inside the new stack
+struct user_args {
+  int argc;
+  char **argv;
+  char **envp;
+  uint64_t *auxv; // (type, value) pairs, ends with AT_NULL
+  uintptr_t sp;
+};
+
 /**
- * @brief Place argv into user stack
- * @param src_sp the original user sp value
- * @param src_argv argv to copy from
- * @param ret_argc (total argc count)
- * @param ret_argv (alt)
- * @param ret_sp new sp value
+ * @brief Build the initial user stack of a program
+ *
+ * High
+ * | strings   | <- stack_top, argv and envp strings packed
+ * | (padding) |
+ * | auxv      | (type, value) pairs, ends with AT_NULL
+ * | envp      | ends with NULL
+ * | argv      | ends with NULL
+ * | argc      | <- sp (16 bytes aligned)
+ * Low
+ *
+ * argv/envp come from the caller (validated as user memory), sizes are
+ * measured once and every string is copied once, straight into the stack.
+ * @param envp NULL for an empty environment
+ * @param entry entry point of the program (AT_ENTRY)
+ * @retval 0 on success, -1 if argv/envp is not accessible or too large
  */
-void place_args(/*IN*/ uintptr_t src_sp,
-                /*IN*/ char *const src_argv[],
-                /*OUT*/ int *ret_argc,
-                /*OUT*/ char ***ret_argv,
-                /*OUT*/ uintptr_t *ret_sp);
+int place_args(/*IN*/ uintptr_t stack_top,
+               /*IN*/ char *const argv[],
+               /*IN*/ char *const envp[],
+               /*IN*/ uintptr_t entry,
+               /*OUT*/ struct user_args *out);
 
 // Only used for running tests
-void test_argv_parse();
\ No newline at end of file
+void test_argv_parse();
@@ -1,8 +1,38 @@
 #pragma once
+#include "mm/frame.h"
+#include "proc/argv.h"
 #include <stddef.h>
+#include <stdint.h>
+
+// Memory holding a program image, and the size of a user stack
+#define EXEC_CODE_SIZE FRAME_SIZE
+#define USER_STACK_SIZE FRAME_SIZE
+
+struct task_struct;
+
+// A loaded program with its user stack, ready to be installed into a task
+struct exec_image {
+  struct task_code *code;
+  uintptr_t user_stack;
+  struct user_args args; // inside the user stack
+};
+
 void *load_program(const char *name, /*OUT*/ size_t *target_size);
 int exec(const char *name, char *const argv[]);
 
+// Load a program and place argv/envp/auxv onto a new user stack
+// @retval 0 for success, -1 if the program is not found
+int exec_prepare(const char *name, char *const argv[], char *const envp[],
+                 /*OUT*/ struct exec_image *img);
+
+// Replace the user space of a task with the image
+void exec_install(struct task_struct *task, struct exec_image *img);
+
+// Start running the user program of the current task, never returns
+// main() gets (argc, argv, envp), sp points to argc
+void exec_enter_user(struct task_struct *task, const struct user_args *args);
+
 // Create and bind a user thread to current running task.
-// Exec as user code
-void exec_user(const char *name, char *const argv[]);
\ No newline at end of file
+// Exec as user code, only returns if the program could not be loaded
+// envp could be NULL for an empty environment
+void exec_user(const char *name, char *const argv[], char *const envp[]);
\ No newline at end of file
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "bool.h"
+#include <stdint.h>
+
+/**
+ * Lazy FP/SIMD context switching
+ *
+ * The kernel is built with -mgeneral-regs-only, so q0-q31/fpsr/fpcr only ever
+ * hold user state and are left alone by exception entry (save_all).
+ * FP/SIMD access is disabled through CPACR_EL1.FPEN whenever a task is
+ * switched in, the first FP instruction of the task then traps into
+ * fpsimd_trap_handler, which enables access and restores the task's state.
+ * Tasks which never use FP/SIMD never own a save area and cost nothing on a
+ * context switch.
+ *
+ * Registers are saved at switch-out (only if the task touched them), so a task
+ * could migrate freely. Coming back to the core which still holds its
+ * registers skips the restore.
+ * */
+
+// CPACR_EL1.FPEN: 0b11 -> no trap, 0b00 -> trap FP/SIMD at EL0 and EL1
+#define CPACR_FPEN_MASK (3 << 20)
+#define CPACR_FPEN_ENABLE (3 << 20)
+#define CPACR_FPEN_TRAP (0 << 20)
+
+// Layout must match proc/fpsimd_regs.S
+struct fpsimd_state {
+  uint64_t vregs[64]; // q0-q31
+  uint32_t fpsr;
+  uint32_t fpcr;
+} __attribute__((aligned(16)));
+
+struct task_struct;
+
+static inline bool fpsimd_enabled() {
+  uint64_t cpacr;
+  asm volatile("mrs %0, cpacr_el1 \n" : "=r"(cpacr));
+  return (cpacr & CPACR_FPEN_MASK) == CPACR_FPEN_ENABLE;
+}
+
+// EL0 accessed FP/SIMD while it's disabled (EC 0x07)
+void fpsimd_trap_handler();
+
+// Save the live registers of `prev` (if any) and disable access
+// Called by the scheduler right before switching away from `prev`
+void fpsimd_switch_out(struct task_struct *prev);
+
+// Child inherits a copy of the parent's FP/SIMD state
+void fpsimd_fork(struct task_struct *child, struct task_struct *parent);
+
+// Drop the FP/SIMD state of a task (exit, exec)
+void fpsimd_release(struct task_struct *task);
+
+/**
+ * Allow the kernel to use FP/SIMD (e.g. NEON memcpy), the state of the current
+ * task is saved first.
+ * Caution: must not schedule before kernel_fpsimd_end
+ */
+void kernel_fpsimd_begin();
+void kernel_fpsimd_end();
+
+// proc/fpsimd_regs.S
+void fpsimd_save_state(struct fpsimd_state *state);
+void fpsimd_load_state(const struct fpsimd_state *state);
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "bool.h"
+#include <stdint.h>
+
+/**
+ * Kernel threads
+ *  kthread_create runs `fn(arg)` in a new task with a kernel stack of
+ *  FRAME_SIZE << stack_order bytes. The value returned by `fn` is kept until
+ *  another task collects it with kthread_join, which also frees the thread.
+ *
+ * Kernel stacks are recycled through a small pool per order, so short-lived
+ * workers don't go through the buddy allocator every time.
+ * A magic word at the lowest address of each stack stands in for a guard page
+ * (no MMU yet), and is checked every time the owner is switched out.
+ * */
+
+struct task_struct;
+
+typedef int (*kthread_fn)(void *arg);
+
+// Largest stack: FRAME_SIZE << KSTACK_MAX_ORDER
+#define KSTACK_MAX_ORDER 3
+
+// Number of free stacks cached per order
+#define KSTACK_POOL_SIZE 8
+
+#define KSTACK_MAGIC 0x57ac4f1e57ac4f1eULL
+
+#define kstack_size(order) (FRAME_SIZE << (order))
+
+// @retval NULL if the stack_order is not supported or out of memory
+struct task_struct *kthread_create(kthread_fn fn, void *arg, int stack_order);
+
+/**
+ * @brief Wait for a kernel thread to finish, then free it
+ * @param ret exit value of the thread (could be NULL)
+ * @retval 0 for success, -1 if the task is not joinable or already being
+ *  joined
+ */
+int kthread_join(struct task_struct *thread, int *ret);
+
+// Allocate/free a kernel stack (address of the lowest byte)
+uintptr_t kstack_alloc(int order);
+void kstack_free(uintptr_t stack, int order);
+
+// @retval true if the task has written below its kernel stack
+bool kstack_overflowed(struct task_struct *task);
+
+// Only used for running tests, needs the scheduler: call it from a task
+void test_kthread();
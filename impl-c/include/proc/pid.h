@@ -0,0 +1,61 @@
+#pragma once
+
+#include "spinlock.h"
+#include <stdint.h>
+
+/**
+ * PID allocator
+ *  PIDs are handed out from a bitmap, continuing after the last allocated one
+ *  (so a freed PID is not reused right away) and wrapping around once the end
+ *  is reached. A table indexed by PID gives the task in O(1).
+ * */
+
+#define PID_MAX 4096
+
+struct task_struct;
+
+struct pid_map {
+  spinlock_t lock;
+  int max;     // number of PIDs, multiple of 64
+  int last;    // last allocated PID
+  int nr_used; // number of PIDs in use
+  uint64_t *bitmap;
+  struct task_struct **tasks;
+};
+
+// Storage of a pid_map with `max` PIDs
+#define PID_MAP_DEFINE(_name, _max)                                            \
+  static uint64_t _name##_bitmap[(_max) / 64];                                 \
+  static struct task_struct *_name##_tasks[(_max)];                            \
+  struct pid_map _name = {                                                     \
+      .lock = SPINLOCK_INIT(#_name),                                           \
+      .max = (_max),                                                           \
+      .last = -1,                                                              \
+      .nr_used = 0,                                                            \
+      .bitmap = _name##_bitmap,                                                \
+      .tasks = _name##_tasks,                                                  \
+  }
+
+// @retval a free PID bound to the task, -1 if all PIDs are used
+int pid_map_alloc(struct pid_map *map, struct task_struct *task);
+void pid_map_free(struct pid_map *map, int pid);
+// @retval NULL if the PID is not in use
+struct task_struct *pid_map_lookup(struct pid_map *map, int pid);
+
+// System-wide PIDs
+int pid_alloc(struct task_struct *task);
+void pid_free(int pid);
+
+/**
+ * @brief Get the task owning a PID
+ * Caution: the task is not pinned, caller must make sure it's not freed
+ * concurrently (e.g. the caller is its parent)
+ */
+struct task_struct *pid_lookup(int pid);
+
+// Call fn on every task owning a PID, in PID order. A task can't be freed
+// while fn runs (the map is locked), so fn must not sleep or allocate a PID.
+void pid_for_each(void (*fn)(struct task_struct *task, void *arg), void *arg);
+
+// Only used for running tests
+void test_pid();
@@ -1,15 +1,38 @@
 #pragma once
 
 #include "list.h"
-
-extern struct list_head run_queue;
-extern struct list_head exited;
+#include "proc/smp.h"
+#include "spinlock.h"
+#include <stdint.h>
 
 struct task_entry {
   struct list_head list;
   struct task_struct *task;
 };
 
+/**
+ * Per-CPU run queue
+ *  Holds runnable tasks waiting for the core, the running task is not inside.
+ *  A core with an empty queue steals work from the busiest queue before
+ *  falling back to its idle task.
+ * */
+struct run_queue {
+  spinlock_t lock;
+  struct list_head list;
+  volatile int nr_queued;
+};
+
+extern struct run_queue run_queues[SMP_NUM_CPUS];
+
+#define SCHED_CPUS_ALL ((1 << SMP_NUM_CPUS) - 1)
+
+// A task switched out less than this long ago still has a warm cache on its
+// core, so it's not worth migrating.
+#define SCHED_MIGRATION_COST_US 500
+
+// Queue length from which even cache-hot tasks could be stolen
+#define SCHED_STEAL_HOT_THRESHOLD 2
+
 void scheduler_init();
 
 // Root of all tasks, would recycle exited thread
@@ -17,4 +40,20 @@ void idle();
 
 void task_schedule();
 
+// Make a task visible to the scheduler
+void sched_enqueue(struct task_struct *task);
+
+// Finish a context switch in the context of the next task
+void schedule_tail(struct task_struct *prev);
+
+// Make a TASK_STATUS_SLEEPING task runnable again
+void sched_wakeup(struct task_struct *task);
+
+// Hand a dead task (already switched out) to the idle task to be freed
+void sched_reap(struct task_struct *task);
+
+// Restrict the cores a task could run on (bit n -> cpu n)
+// @retval 0 for success, -1 if the mask contains no core
+int sched_set_affinity(struct task_struct *task, uint32_t mask);
+
 void _dump_runq();
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "bool.h"
+#include <stdint.h>
+
+/**
+ * SMP: bring up the secondary Cortex-A53 cores
+ *
+ * Cores 1-3 are released through the spin table at SMP_SPIN_TABLE_BASE:
+ * writing an entry address into the slot of a core and issuing `sev` makes the
+ * parked core jump to it. Every core then owns a slice of the boot stack area,
+ * its own `tpidr_el1` (current task) and an idle task.
+ * */
+
+#define SMP_NUM_CPUS 4
+
+// Keep in sync with kernel/entry.S
+#define SMP_SPIN_TABLE_BASE 0xd8
+#define SMP_CPU_STACK_SIZE 0x8000
+
+struct cpu_info {
+  int id;
+  volatile bool online;
+
+  // Task to run while nothing else is runnable on this core,
+  // never be placed into the run queue
+  struct task_struct *idle;
+
+  // Task whose FP/SIMD state is held by the registers of this core
+  struct task_struct *fpsimd_owner;
+};
+
+extern struct cpu_info cpus[SMP_NUM_CPUS];
+
+static inline int smp_cpu_id() {
+  uint64_t mpidr;
+  asm volatile("mrs %0, mpidr_el1 \n" : "=r"(mpidr) :);
+  return mpidr & 0x3;
+}
+
+static inline struct cpu_info *this_cpu() { return &cpus[smp_cpu_id()]; }
+
+// Setup the boot core and release all secondary cores
+void smp_init();
+
+// C entry of secondary cores (called from kernel/entry.S)
+void smp_secondary_main(int cpuid);
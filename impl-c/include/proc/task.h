@@ -1,10 +1,16 @@
 #pragma once
+#include "atomic.h"
+#include "proc/acct.h"
+#include "bool.h"
 #include "fs/vfs.h"
+#include "list.h"
+#include "spinlock.h"
 #include <stddef.h>
 #include <stdint.h>
 
 #define TASK_STATUS_DEAD 0
 #define TASK_STATUS_ALIVE 1
+#define TASK_STATUS_SLEEPING 2 // not runnable until sched_wakeup
 #define TASK_MX_NUM_FD 10
 
 struct cpu_context {
@@ -23,30 +29,125 @@ struct cpu_context {
   uint64_t sp; // kernel stack pointer
 };
 
+// Program image loaded by exec, shared with forked children
+struct task_code {
+  atomic_t refcnt;
+  void *addr;
+  size_t size;
+};
+
 struct task_struct {
   struct cpu_context cpu_context;
-  unsigned long id;
+  int id; // PID
   int status;
+  int exit_code;
+
+  // Freed by kthread_join instead of the idle task once exited
+  bool joinable;
+  struct task_struct *joiner; // sleeping in kthread_join, woken up on exit
+
+  // Serialize sleep/wakeup against switching out the task
+  spinlock_t lock;
+
+  // Process hierarchy, protected by proc_lock (proc/wait.c)
+  // An exited child stays as a zombie until the parent waits for it
+  struct task_struct *parent;
+  struct list_head children; // list of children linked by `sibling`
+  struct list_head sibling;
+
+  // Set while running on a core, would not be picked by other cores
+  volatile bool on_cpu;
+
+  // Scheduling
+  int cpu;               // core the task is queued/running on
+  uint32_t cpus_allowed; // affinity mask, bit n set -> may run on cpu n
+  uint64_t last_ran;     // cntpct_el0 when the task was switched out
+  struct task_entry *sched_entry; // node linked into a run queue
+
+  // CPU accounting (see proc/acct.h)
+  struct task_rusage rusage;
+  struct task_rusage child_rusage; // of reaped children
+  uint64_t acct_stamp;             // cntpct_el0 at the start of this slice
+
+  // FP/SIMD, allocated on first use (see proc/fpsimd.h)
+  struct fpsimd_state *fpsimd;
+  int fpsimd_cpu; // core which last loaded the state, -1 if none
 
   int fd_size;
   struct file *fd[TASK_MX_NUM_FD];
 
+  // Working directory for relative paths, NULL for the root. cwd_path is its
+  // absolute name, kept by sys_chdir for getcwd (vnodes have no names)
+  struct vnode *cwd;
+  char cwd_path[VFS_PATH_MAX];
+
   uintptr_t kernel_stack;
+  int stack_order; // size of kernel_stack: FRAME_SIZE << stack_order
   uintptr_t user_stack;
   uintptr_t user_sp; // value of sp in el0
 
-  // address of the program code allocaed in memory
-  void *code;
-  size_t code_size;
+  // program code allocaed in memory
+  struct task_code *code;
 };
 
+// Create a task without making it runnable
+struct task_struct *task_alloc(void *func);
+
+// Same as task_alloc, with a kernel stack of FRAME_SIZE << stack_order
+struct task_struct *task_alloc_stack(void *func, int stack_order);
+
+// Create a runnable task
 struct task_struct *task_create(void *func);
 
+// Create the idle task for the calling core, which is bound to the stack
+// currently in use
+struct task_struct *task_create_idle();
+
 void task_free(struct task_struct *task);
 
 void cur_task_exit();
 
-extern uint32_t new_tid;
+// Exit the current task with an exit code
+void task_exit(int exit_code);
+
+// Free memory owned by user space (code, user stack) and close all files
+void task_release_user(struct task_struct *task);
+
+// A forked or spawned child starts in the working directory of its parent
+void task_copy_cwd(struct task_struct *child, const struct task_struct *parent);
+
+static inline struct task_code *task_code_get(struct task_code *code) {
+  if (code != NULL) {
+    atomic_inc(&code->refcnt);
+  }
+  return code;
+}
+
+// Drop a reference, the code is freed with the last one
+void task_code_put(struct task_code *code);
+
+/* proc/wait.c */
+
+// Link a newly created child under its parent
+void task_add_child(struct task_struct *parent, struct task_struct *child);
+
+// Reparent children and notify the parent, called by an exiting task
+void task_exit_notify(struct task_struct *task);
+
+/**
+ * @brief Mark a dead task as switched out (clear on_cpu)
+ * @retval true if no one would wait for the task (should be freed by idle)
+ */
+bool task_switched_out_dead(struct task_struct *task);
+
+// Block until a child (any child if pid == -1) exits, then free it
+// @retval pid of the child, -1 if there's no such child, -EFAULT if status
+//  is not writable (the child is kept)
+int task_waitpid(int pid, int *status);
+
+// Block until a joinable kernel thread exits, the caller frees it
+// @retval 0 for succeed, -1 if another task is joining the thread
+int task_join(struct task_struct *thread);
 
 static inline void _wait() {
   for (uint64_t j = 0; j < (1 << 27); j++) {
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "config.h"
+#include <stdint.h>
+
+/**
+ * Scheduler tracing
+ *  Every core records binary events into its own ring buffer, stamped with
+ *  cntpct_el0. Only the owning core writes to a ring (with IRQ masked), so
+ *  recording takes no lock, only a few stores and barriers. The oldest events
+ *  are overwritten once a ring is full.
+ *
+ *  A ring is marked `writing` while an event goes in. trace_dump pauses
+ *  recording, then waits on the mark before reading and clearing the ring.
+ *
+ *  trace_dump prints the rings over UART as hex records, which are decoded
+ *  by scripts/trace_decode.py into Chrome trace / Perfetto JSON.
+ *
+ * Enabled with CFG_TRACE, recording compiles to nothing otherwise.
+ * */
+
+// Number of events per core, must be a power of 2
+#define TRACE_RING_SIZE 1024
+
+// Keep in sync with scripts/trace_decode.py
+enum trace_type {
+  TRACE_SWITCH = 1,        // pid: prev, arg: next
+  TRACE_WAKEUP = 2,        // pid: woken task, arg: cpu of the waker
+  TRACE_FORK = 3,          // pid: parent, arg: child
+  TRACE_EXIT = 4,          // pid: exiting task, arg: exit code
+  TRACE_SYSCALL_ENTER = 5, // pid: caller, arg: syscall number
+  TRACE_SYSCALL_EXIT = 6,  // pid: caller, arg: return value
+};
+
+// 24 bytes, dumped as is (little-endian)
+struct trace_event {
+  uint64_t ts; // cntpct_el0
+  uint16_t type;
+  uint16_t cpu;
+  int32_t pid;
+  int64_t arg;
+};
+
+#ifdef CFG_TRACE
+void trace_record(enum trace_type type, int pid, int64_t arg);
+#else
+static inline void trace_record(enum trace_type type, int pid, int64_t arg) {}
+#endif
+
+// Print all recorded events over UART, and clear the rings
+void trace_dump();
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Batched I/O
+ *  readv/writev move several buffers of one file in a single syscall.
+ *
+ *  An io_ring batches operations on any file: user space fills submission
+ *  entries (SQE) in its own memory, bumps `sq_tail` and calls io_submit once.
+ *  The kernel runs the entries in order and posts one completion (CQE) per
+ *  entry, carrying `user_data` back with the result of the operation. There's
+ *  no MMU, so the ring is shared by simply passing its address.
+ *
+ *  Indices only grow (wrap at 2^32) and are masked with IO_RING_ENTRIES - 1.
+ *  Submission stops early when the completion queue is full.
+ * */
+
+// Keep in sync with user_programs/lib.h
+#define IOV_MAX 16
+#define IO_RING_ENTRIES 16 // power of 2
+
+struct iovec {
+  void *iov_base;
+  size_t iov_len;
+};
+
+enum io_op {
+  IO_OP_NOP = 0,
+  IO_OP_OPEN = 1,   // addr: pathname, flags: open flags
+  IO_OP_CLOSE = 2,  // fd
+  IO_OP_READ = 3,   // fd, addr: buffer, len
+  IO_OP_WRITE = 4,  // fd, addr: buffer, len
+  IO_OP_READV = 5,  // fd, addr: struct iovec[], len: iovcnt
+  IO_OP_WRITEV = 6, // fd, addr: struct iovec[], len: iovcnt
+};
+
+struct io_sqe {
+  uint32_t opcode;
+  int32_t fd;
+  uint64_t addr;
+  uint32_t len;
+  int32_t flags;
+  uint64_t user_data;
+};
+
+struct io_cqe {
+  uint64_t user_data;
+  int64_t res; // return value of the matching syscall
+};
+
+struct io_ring {
+  volatile uint32_t sq_head; // advanced by the kernel
+  volatile uint32_t sq_tail; // advanced by user space
+  volatile uint32_t cq_head; // advanced by user space
+  volatile uint32_t cq_tail; // advanced by the kernel
+  struct io_sqe sq[IO_RING_ENTRIES];
+  struct io_cqe cq[IO_RING_ENTRIES];
+};
+
+// @retval total bytes transferred, -1 if nothing could be transferred
+int sys_readv(int fd, const struct iovec *iov, int iovcnt);
+int sys_writev(int fd, const struct iovec *iov, int iovcnt);
+
+// Run all queued submissions of the ring
+// @retval number of entries consumed, -EFAULT if the ring is not accessible
+int sys_io_submit(struct io_ring *ring);
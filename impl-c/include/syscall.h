@@ -1,8 +1,59 @@
 #pragma once
+#include "errno.h"
 #include "exception.h"
+#include "proc/acct.h"
+#include "proc/uio.h"
 #include "stddef.h"
+#include "stdint.h"
+
+/**
+ * Syscall table
+ *  Every syscall is described by a `struct syscall_desc` indexed by its
+ *  number. Arguments are taken from x0..x(nargs-1) of the caller (others read
+ *  as 0), and the return value is written back to x0. Unknown numbers return
+ *  -ENOSYS.
+ *
+ * Fast path (_el0_sync in kernel/entry.S)
+ *  Syscalls flagged SYSCALL_FAST skip the trap frame: only caller-saved
+ *  registers are saved before calling syscall_fast. Their handlers run with
+ *  IRQ masked and must not schedule, sleep or access the trap frame.
+ *
+ * Enable CFG_SYSCALL_STATS for per-syscall latency histograms.
+ * */
+
+// Keep in sync with kernel/entry.S, at most 64 (syscall_fast_mask)
+#define SYSCALL_NR 32
+
+#define SYSCALL_FAST (1 << 0)       // served by the fast path
+#define SYSCALL_TRAP_FRAME (1 << 1) // takes the trap frame as the only arg
+
+typedef int64_t (*syscall_fn)(uint64_t a0, uint64_t a1, uint64_t a2,
+                              uint64_t a3, uint64_t a4, uint64_t a5);
+
+struct syscall_desc {
+  const char *name; // NULL if not implemented
+  int nargs;
+  uint32_t flags;
+  syscall_fn fn;
+};
+
+extern const struct syscall_desc syscall_table[SYSCALL_NR];
+
+// Bit n is set if syscall n is flagged SYSCALL_FAST, read by kernel/entry.S
+extern uint64_t syscall_fast_mask;
+
+void syscall_init();
+
+// Slow path, called by syn_handler with the trap frame of the caller
 void syscall_routing(int num, struct trap_frame *);
 
+// Fast path, called by kernel/entry.S with x0-x5 of the caller untouched
+int64_t syscall_fast(uint64_t a0, uint64_t a1, uint64_t a2, uint64_t a3,
+                     uint64_t a4, uint64_t a5, int num);
+
+// Print call counts and latency histograms (requires CFG_SYSCALL_STATS)
+void syscall_show_stats();
+
 // define syscall numbers
 #define SYS_GETPID 1
 #define SYS_UART_READ 2
@@ -14,19 +65,49 @@ void syscall_routing(int num, struct trap_frame *);
 #define SYS_CLOSE 8
 #define SYS_WRITE 9
 #define SYS_READ 10
+#define SYS_WAITPID 11
+#define SYS_SPAWN 12
+#define SYS_GETRUSAGE 13
+#define SYS_READV 14
+#define SYS_WRITEV 15
+#define SYS_IO_SUBMIT 16
+#define SYS_CHDIR 17
+#define SYS_GETCWD 18
 
 int sys_getpid();
 size_t sys_uart_write(const char buf[], size_t size);
 size_t sys_uart_read(char buf[], size_t size);
 
-int sys_exec(const char *name, char *const args[]);
-void sys_exit();
+// envp could be NULL for an empty environment
+int sys_exec(const char *name, char *const args[], char *const envp[]);
+
+// Run a program in a new child task without duplicating the caller
+// @retval pid of the child, -1 if the program could not be started
+int sys_spawn(const char *name, char *const argv[], char *const envp[]);
+void sys_exit(int status);
 int sys_fork(const struct trap_frame *tf);
 
 #define SYS_OPEN_MX_FD_REACHED -2
 #define SYS_OPEN_FILE_NOT_FOUND -3
 int sys_open(const char *pathname, int flags);
 
+// Relative paths given to open and chdir start from the working directory
+// @retval 0 on success, -ENOENT, -ENOTDIR, -ENAMETOOLONG or -EFAULT
+int sys_chdir(const char *pathname);
+
+// Copy the absolute path of the working directory into buf
+// @retval length including the NUL, -ERANGE if buf is too small, -EFAULT
+int sys_getcwd(char *buf, size_t size);
+
 int sys_close(int fd);
 int sys_write(int fd, const void *buf, int count);
 int sys_read(int fd, void *buf, int count);
+
+// Wait for a child to exit, pid == -1 for any child
+// @retval pid of the exited child, -1 if there's no child to wait for
+int sys_waitpid(int pid, int *status);
+
+// Resource usage of the caller (RUSAGE_SELF) or its reaped children
+// (RUSAGE_CHILDREN)
+// @retval 0 on success, -1 if `who` is invalid, -EFAULT for a bad pointer
+int sys_getrusage(int who, struct rusage *usage);
@@ -1,4 +1,6 @@
 #include "exception.h"
+#include "proc/acct.h"
+#include "proc/fpsimd.h"
 #include "syscall.h"
 #include "timer.h"
 #include "uart.h"
@@ -6,10 +8,15 @@
 #include "stddef.h"
 #include "stdint.h"
 
+#define EC_FP_SIMD_ACCESS 0b000111
 #define EC_SVC_AARCH64 0b010101
 #define EC_SVC_DATA_ABORT 0b100101
 #define EC_SP_ALIGNMENT_FAULT 0b100100
 
+// SPSR_EL1.M[3:0], exception level and stack pointer the exception is taken
+#define SPSR_MODE_MASK 0xf
+#define SPSR_MODE_EL0T 0b0000
+
 // Get field inside an int
 // example: EC is at bit 29-24 in variable "ELR"
 //  ->  get_bits(ELR, 24, 6)
@@ -35,6 +42,14 @@ void dumpState() {
 void syn_handler(struct trap_frame *tf) {
   struct Exception exception;
   uint32_t esr_el1;
+  uint64_t spsr_el1;
+
+  // Read before anything could switch to another task
+  asm volatile("mrs %0, spsr_el1 \n" : "=r"(spsr_el1) :);
+  bool from_user = (spsr_el1 & SPSR_MODE_MASK) == SPSR_MODE_EL0T;
+  if (from_user) {
+    acct_enter_kernel();
+  }
 
   asm volatile("mrs %0, elr_el1 \n" : "=r"(exception.ret_addr) :);
   asm volatile("mrs %0, esr_el1 \n" : "=r"(esr_el1) :);
@@ -49,6 +64,9 @@ void syn_handler(struct trap_frame *tf) {
   case EC_SVC_AARCH64:
     syscall_routing(tf->regs[8], tf);
     break;
+  case EC_FP_SIMD_ACCESS:
+    fpsimd_trap_handler();
+    break;
   case EC_SVC_DATA_ABORT:
     dumpState();
     uart_println("Data abort taken, ec:%x iss:%x", exception.ec, exception.iss);
@@ -74,9 +92,14 @@ void syn_handler(struct trap_frame *tf) {
       ;
     }
   }
+  if (from_user) {
+    acct_exit_kernel();
+  }
 }
 
+// Only taken from EL0 (see exception_vector_table)
 void irq_handler() {
+  acct_enter_kernel();
   unsigned long cntpct = timer_el0_get_cnt();
   unsigned long cntfrq = timer_el0_get_freq();
   unsigned long tmp = cntpct * 10 / cntfrq;
@@ -84,6 +107,7 @@ void irq_handler() {
   uart_println("Time Elapsed: %d.%ds", tmp / 10, tmp % 10);
   uart_println("--------------------");
   timer_el0_set_timeout();
+  acct_exit_kernel();
 }
 
 void _handler_not_impl() {
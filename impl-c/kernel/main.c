@@ -1,4 +1,6 @@
 #include "config.h"
+#include "dev/cpio.h"
+#include "dev/lz4.h"
 #include "dev/sd.h"
 #include "fatal.h"
 #include "fs/fat.h"
@@ -7,11 +9,13 @@
 #include "mm.h"
 #include "mm/startup.h"
 #include "proc.h"
+#include "proc/smp.h"
 #include "shell/shell.h"
 #include "test.h"
 #include "uart.h"
 
 #include "string.h"
+#include "syscall.h"
 
 #define ANSI_GREEN(s) ("\033[0;32m" s "\033[0m")
 
@@ -21,6 +25,7 @@ extern unsigned char __kernel_start, __kernel_end;
 static void init_sys(char *name, void (*func)(void));
 static inline void run_shell();
 static void reserve_startup_area();
+static void index_initramfs();
 
 static void tmpfs_lab7_demo() {
   {
@@ -88,11 +93,13 @@ void main() {
   init_sys("Init Startup allocator", startup_init);
   init_sys("Reserve memory area", reserve_startup_area);
   init_sys("Init Memory Allocator", KAllocManager_init);
+  init_sys("Index initramfs", index_initramfs);
 
   // KAllocManager_run_example();
   // KAllocManager_show_status();
 
   init_sys("Init Proc subsystem", proc_init);
+  init_sys("Init syscall table", syscall_init);
   init_sys("SD card driver", sd_init);
 
 #ifdef CFG_RUN_TEST
@@ -116,6 +123,7 @@ void main() {
   fat_lab8_demo();
   // FATAL("Done");
 
+  init_sys("Bring up secondary cores", smp_init);
   test_tasks();
   // run_shell();
 }
@@ -134,10 +142,30 @@ void reserve_startup_area() {
   startup_reserve((void *)(&__kernel_start),
                   (&__kernel_end - &__kernel_start)); // kernel
   // startup_reserve((void *)(&kn_end), mem_size / PAGE_SIZE);    // buddy
+  // Initramfs, tmpfs files reference their content in place
+  unsigned long ramfs_size = cpioArchiveSize((void *)RAMFS_ADDR);
+  if (ramfs_size == 0) {
+    // Compressed, only read while building tmpfs
+    ramfs_size = lz4_frame_size((void *)RAMFS_ADDR);
+  }
+  if (ramfs_size > 0) {
+    startup_reserve((void *)RAMFS_ADDR, ramfs_size);
+  }
   // System
   startup_reserve((void *)0x3f000000, 0x1000000); // MMIO
 }
 
+void index_initramfs() {
+  // Files of a compressed one are looked up in tmpfs instead
+  if (lz4_is_frame((void *)RAMFS_ADDR)) {
+    uart_println("[cpio] LZ4 compressed initramfs, not indexed");
+    return;
+  }
+  if (cpioBuildIndex((void *)RAMFS_ADDR) != 0) {
+    uart_println("[cpio] no valid initramfs at %x", RAMFS_ADDR);
+  }
+}
+
 void run_shell() {
   struct Shell sh;
   char shell_buffer[MX_CMD_BFRSIZE + 1];
@@ -1,5 +1,10 @@
 #include "syscall.h"
+#include "mm/uaccess.h"
 #include "proc/sched.h"
+#include "proc/smp.h"
+#include "proc/task.h"
+#include "proc/trace.h"
+#include "timer.h"
 #include "uart.h"
 
 #include "config.h"
@@ -11,106 +16,237 @@ static const int _DO_LOG = 1;
 static const int _DO_LOG = 0;
 #endif
 
-#define log(name) log_println("[syscall] -> %s", #name)
+// Parameter list shared by all syscall handlers
+#define SC_ARGS                                                                \
+  uint64_t a0, uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5
 
-void syscall_routing(int num, struct trap_frame *tf) {
-  switch (num) {
-
-  case SYS_GETPID: {
-    log(SYS_GETPID);
-    int pid = sys_getpid();
-    tf->regs[0] = pid;
-    break;
-  }
+static int64_t sc_getpid(SC_ARGS) { return sys_getpid(); }
 
-  case SYS_UART_WRITE: {
-    log(SYS_UART_WRITE);
-    const char *s = (const char *)tf->regs[0];
-    size_t size = (size_t)tf->regs[1];
-    size_t written = sys_uart_write(s, size);
-    tf->regs[0] = written;
-    break;
+static int64_t sc_uart_read(SC_ARGS) {
+  if (!access_ok((void *)a0, a1)) {
+    return -EFAULT;
   }
+  return sys_uart_read((char *)a0, (size_t)a1);
+}
 
-  case SYS_UART_READ: {
-    log(SYS_UART_READ);
-    char *buf = (char *)tf->regs[0];
-    size_t size = tf->regs[1];
-    size_t read = sys_uart_read(buf, size);
-    tf->regs[0] = read;
-    break;
+static int64_t sc_uart_write(SC_ARGS) {
+  if (!access_ok((const void *)a0, a1)) {
+    return -EFAULT;
   }
-
-  case SYS_EXEC: {
-    // we could call schedule at the beginning of syscall_routing (every
-    // syscall) but we only call it here for better logging and also serve a
-    // proof of concept that task schedule works
-    task_schedule();
-
-    log(SYS_EXEC);
-    const char *name = (const char *)tf->regs[0];
-    char *const *argv = (char *const *)(tf->regs[1]);
-    int ret = sys_exec(name, argv);
-    tf->regs[0] = ret;
-    break;
-  }
-
-  case SYS_EXIT: {
-    log(SYS_EXIT);
-    sys_exit();
-    break;
+  return sys_uart_write((const char *)a0, (size_t)a1);
+}
+
+static int64_t sc_exec(SC_ARGS) {
+  // we could call schedule at the beginning of syscall_routing (every
+  // syscall) but we only call it here for better logging and also serve a
+  // proof of concept that task schedule works
+  task_schedule();
+  return sys_exec((const char *)a0, (char *const *)a1, (char *const *)a2);
+}
+
+static int64_t sc_exit(SC_ARGS) {
+  sys_exit((int)a0);
+  return 0;
+}
+
+static int64_t sc_fork(SC_ARGS) {
+  return sys_fork((const struct trap_frame *)a0);
+}
+
+static int64_t sc_open(SC_ARGS) { return sys_open((const char *)a0, (int)a1); }
+
+static int64_t sc_close(SC_ARGS) { return sys_close((int)a0); }
+
+static int64_t sc_write(SC_ARGS) {
+  return sys_write((int)a0, (const void *)a1, (int)a2);
+}
+
+static int64_t sc_read(SC_ARGS) {
+  return sys_read((int)a0, (void *)a1, (int)a2);
+}
+
+static int64_t sc_waitpid(SC_ARGS) {
+  return sys_waitpid((int)a0, (int *)a1);
+}
+
+static int64_t sc_spawn(SC_ARGS) {
+  return sys_spawn((const char *)a0, (char *const *)a1, (char *const *)a2);
+}
+
+static int64_t sc_getrusage(SC_ARGS) {
+  return sys_getrusage((int)a0, (struct rusage *)a1);
+}
+
+static int64_t sc_readv(SC_ARGS) {
+  return sys_readv((int)a0, (const struct iovec *)a1, (int)a2);
+}
+
+static int64_t sc_writev(SC_ARGS) {
+  return sys_writev((int)a0, (const struct iovec *)a1, (int)a2);
+}
+
+static int64_t sc_io_submit(SC_ARGS) {
+  return sys_io_submit((struct io_ring *)a0);
+}
+
+static int64_t sc_chdir(SC_ARGS) { return sys_chdir((const char *)a0); }
+
+static int64_t sc_getcwd(SC_ARGS) {
+  return sys_getcwd((char *)a0, (size_t)a1);
+}
+
+#define SYSCALL(_nr, _fn, _nargs, _flags)                                      \
+  [_nr] = {.name = #_nr, .nargs = (_nargs), .flags = (_flags), .fn = (_fn)}
+
+const struct syscall_desc syscall_table[SYSCALL_NR] = {
+    SYSCALL(SYS_GETPID, sc_getpid, 0, SYSCALL_FAST),
+    SYSCALL(SYS_UART_READ, sc_uart_read, 2, 0),
+    SYSCALL(SYS_UART_WRITE, sc_uart_write, 2, SYSCALL_FAST),
+    SYSCALL(SYS_EXEC, sc_exec, 3, 0),
+    SYSCALL(SYS_EXIT, sc_exit, 1, 0),
+    SYSCALL(SYS_FORK, sc_fork, 0, SYSCALL_TRAP_FRAME),
+    SYSCALL(SYS_OPEN, sc_open, 2, 0),
+    SYSCALL(SYS_CLOSE, sc_close, 1, 0),
+    SYSCALL(SYS_WRITE, sc_write, 3, 0),
+    SYSCALL(SYS_READ, sc_read, 3, 0),
+    SYSCALL(SYS_WAITPID, sc_waitpid, 2, 0),
+    SYSCALL(SYS_SPAWN, sc_spawn, 3, 0),
+    SYSCALL(SYS_GETRUSAGE, sc_getrusage, 2, SYSCALL_FAST),
+    SYSCALL(SYS_READV, sc_readv, 3, 0),
+    SYSCALL(SYS_WRITEV, sc_writev, 3, 0),
+    SYSCALL(SYS_IO_SUBMIT, sc_io_submit, 1, 0),
+    SYSCALL(SYS_CHDIR, sc_chdir, 1, 0),
+    SYSCALL(SYS_GETCWD, sc_getcwd, 2, 0),
+};
+
+uint64_t syscall_fast_mask = 0;
+
+void syscall_init() {
+  uint64_t mask = 0;
+  for (int num = 0; num < SYSCALL_NR; num++) {
+    if (syscall_table[num].fn != NULL &&
+        (syscall_table[num].flags & SYSCALL_FAST)) {
+      mask |= 1ULL << num;
+    }
   }
+  syscall_fast_mask = mask;
+}
 
-  case SYS_FORK: {
-    log(SYS_FORK);
-    int child_id = sys_fork(tf);
-    tf->regs[0] = child_id;
-    break;
+static inline const struct syscall_desc *syscall_lookup(int num) {
+  if (num < 0 || num >= SYSCALL_NR || syscall_table[num].fn == NULL) {
+    return NULL;
   }
-
-  case SYS_OPEN: {
-    log(SYS_OPEN);
-    const char *pathname = (const char *)tf->regs[0];
-    int flags = (int)tf->regs[1];
-    int ret = sys_open(pathname, flags);
-    tf->regs[0] = ret;
-    break;
+  return &syscall_table[num];
+}
+
+#ifdef CFG_SYSCALL_STATS
+// Bucket i counts calls taking [2^i, 2^(i+1)) ticks, bucket 0 also takes 0
+#define SYSCALL_HIST_BUCKETS 32
+
+struct syscall_stat {
+  uint64_t count;
+  uint64_t ticks; // total latency
+  uint32_t hist[SYSCALL_HIST_BUCKETS];
+};
+
+// Only written by the owning core with IRQ masked (as in any syscall)
+static struct syscall_stat syscall_stats[SMP_NUM_CPUS][SYSCALL_NR];
+
+// Latency includes the time a blocking syscall spends sleeping
+static inline void stat_record(int num, uint64_t start) {
+  uint64_t delta = timer_el0_get_cnt() - start;
+  struct syscall_stat *st = &syscall_stats[smp_cpu_id()][num];
+  int bucket = delta == 0 ? 0 : 63 - __builtin_clzll(delta);
+  if (bucket >= SYSCALL_HIST_BUCKETS) {
+    bucket = SYSCALL_HIST_BUCKETS - 1;
   }
+  st->count++;
+  st->ticks += delta;
+  st->hist[bucket]++;
+}
 
-  case SYS_CLOSE: {
-    log(SYS_CLOSE);
-    int fd = (int)tf->regs[0];
-    int ret = sys_close(fd);
-    tf->regs[0] = ret;
-    break;
-  }
-
-  case SYS_WRITE: {
-    log(SYS_WRITE);
-    int fd = (int)tf->regs[0];
-    const void *buf = (const void *)tf->regs[1];
-    int count = (int)tf->regs[2];
-    int ret = sys_write(fd, buf, count);
-    tf->regs[0] = ret;
-    break;
-  }
-
-  case SYS_READ: {
-    log(SYS_READ);
-    int fd = (int)tf->regs[0];
-    void *buf = (void *)tf->regs[1];
-    int count = (int)tf->regs[2];
-    int ret = sys_read(fd, buf, count);
-    tf->regs[0] = ret;
-    break;
-  }
+static inline uint64_t stat_start() { return timer_el0_get_cnt(); }
+#else
+static inline void stat_record(int num, uint64_t start) {}
+static inline uint64_t stat_start() { return 0; }
+#endif
 
-  default: {
-    uart_println("syscall not implemented: %d", num);
-    while (1) {
-      ;
+void syscall_routing(int num, struct trap_frame *tf) {
+  struct task_struct *cur = get_current();
+  const struct syscall_desc *desc = syscall_lookup(num);
+  uint64_t a[6] = {0};
+
+  cur->rusage.nsyscalls++;
+  trace_record(TRACE_SYSCALL_ENTER, cur->id, num);
+  if (desc == NULL) {
+    log_println("[syscall] not implemented: %d", num);
+    tf->regs[0] = -ENOSYS;
+  } else {
+    log_println("[syscall] -> %s", desc->name);
+    if (desc->flags & SYSCALL_TRAP_FRAME) {
+      a[0] = (uint64_t)tf;
+    } else {
+      for (int i = 0; i < desc->nargs; i++) {
+        a[i] = tf->regs[i];
+      }
     }
-    break;
+    uint64_t start = stat_start();
+    tf->regs[0] = desc->fn(a[0], a[1], a[2], a[3], a[4], a[5]);
+    stat_record(num, start);
   }
+  // Might be another task (a forked child never gets here)
+  trace_record(TRACE_SYSCALL_EXIT, get_current()->id, tf->regs[0]);
+}
+
+// Time spent in fast handlers is charged to user time (see proc/acct.h)
+int64_t syscall_fast(uint64_t a0, uint64_t a1, uint64_t a2, uint64_t a3,
+                     uint64_t a4, uint64_t a5, int num) {
+  struct task_struct *cur = get_current();
+  cur->rusage.nsyscalls++;
+  trace_record(TRACE_SYSCALL_ENTER, cur->id, num);
+  uint64_t start = stat_start();
+  int64_t ret = syscall_table[num].fn(a0, a1, a2, a3, a4, a5);
+  stat_record(num, start);
+  trace_record(TRACE_SYSCALL_EXIT, cur->id, ret);
+  return ret;
+}
+
+#ifdef CFG_SYSCALL_STATS
+void syscall_show_stats() {
+  uint64_t freq = timer_el0_get_freq();
+  struct syscall_stat sum;
+  for (int num = 0; num < SYSCALL_NR; num++) {
+    sum = (struct syscall_stat){0};
+    for (int cpuid = 0; cpuid < SMP_NUM_CPUS; cpuid++) {
+      struct syscall_stat *st = &syscall_stats[cpuid][num];
+      sum.count += st->count;
+      sum.ticks += st->ticks;
+      for (int i = 0; i < SYSCALL_HIST_BUCKETS; i++) {
+        sum.hist[i] += st->hist[i];
+      }
+    }
+    if (sum.count == 0) {
+      continue;
+    }
+    uart_println("%s: calls:%d avg:%dns", syscall_table[num].name,
+                 (int)sum.count,
+                 (int)(sum.ticks / sum.count * 1000000000 / freq));
+    for (int i = 0; i < SYSCALL_HIST_BUCKETS; i++) {
+      if (sum.hist[i] == 0) {
+        continue;
+      }
+      uint64_t ns = (1ULL << i) * 1000000000 / freq;
+      if (ns < 1000000) {
+        uart_println("  >= 2^%d ticks (%dns): %d", i, (int)ns, sum.hist[i]);
+      } else {
+        uart_println("  >= 2^%d ticks (%dus): %d", i, (int)(ns / 1000),
+                     sum.hist[i]);
+      }
+    }
   }
-}
\ No newline at end of file
+}
+#else
+void syscall_show_stats() {
+  uart_println("[syscall] enable CFG_SYSCALL_STATS for latency histograms");
+}
+#endif
@@ -1,26 +1,42 @@
 #include "test.h"
 #include "config.h"
+#include "dev/cpio.h"
+#include "dev/lz4.h"
 #include "dev/mbr.h"
+#include "fs/dcache.h"
 #include "fs/fat.h"
+#include "fs/pagecache.h"
+#include "fs/tmpfs.h"
 #include "fs/vfs.h"
 #include "mm/startup.h"
+#include "mm/uaccess.h"
 #include "proc/argv.h"
+#include "proc/pid.h"
 #include "shell/buffer.h"
 #include "shell/cmd.h"
 
+#include "spinlock.h"
 #include "string.h"
 
 void run_tests() {
 
   // lib
   test_string();
+  test_lock();
 
   // components
   test_startup_alloc();
+  test_uaccess();
   test_shell_buffer();
   test_shell_cmd();
   test_argv_parse();
+  test_pid();
   test_vfs();
+  test_dcache();
+  test_pcache();
+  test_tmpfs();
+  test_cpio();
+  test_lz4();
   test_mbr();
   test_fat();
 }
\ No newline at end of file
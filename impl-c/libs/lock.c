@@ -0,0 +1,78 @@
+#include "atomic.h"
+#include "rwlock.h"
+#include "spinlock.h"
+
+#include "config.h"
+#include "test.h"
+#include "uart.h"
+
+void spin_lock_report(spinlock_t *lock) {
+#ifdef CFG_LOCK_STAT
+  uart_println("[lock] %s: acquired:%d contended:%d", lock->name,
+               lock->stat.acquired, lock->stat.contended);
+#else
+  uart_println("[lock] %s: enable CFG_LOCK_STAT for contention counters",
+               lock->name);
+#endif
+}
+
+#ifdef CFG_RUN_LIB_LOCK_TEST
+bool test_spin_trylock() {
+  spinlock_t lock = SPINLOCK_INIT("test");
+  assert(!spin_is_locked(&lock));
+  assert(spin_trylock(&lock) == true);
+  assert(spin_is_locked(&lock));
+  assert(spin_trylock(&lock) == false);
+  spin_unlock(&lock);
+  assert(!spin_is_locked(&lock));
+
+  // Tickets keep going after owner/next wrap around
+  lock.owner = lock.next = 0xffff;
+  spin_lock(&lock);
+  assert(lock.owner == 0xffff && lock.next == 0);
+  spin_unlock(&lock);
+  assert(!spin_is_locked(&lock));
+  return true;
+}
+
+bool test_atomic() {
+  atomic_t v = ATOMIC_INIT(1);
+  assert(atomic_add_return(&v, 2) == 3);
+  assert(atomic_sub_return(&v, 1) == 2);
+  atomic_inc(&v);
+  assert(atomic_read(&v) == 3);
+  atomic_dec(&v);
+  atomic_dec(&v);
+  assert(atomic_dec_and_test(&v));
+  assert(atomic_cmpxchg(&v, 1, 5) == 0);
+  assert(atomic_read(&v) == 0);
+  assert(atomic_cmpxchg(&v, 0, 5) == 0);
+  assert(atomic_read(&v) == 5);
+  return true;
+}
+
+bool test_rwlock() {
+  rwlock_t rw = RWLOCK_INIT("test");
+  read_lock(&rw);
+  read_lock(&rw);
+  assert(rw.lock == 2);
+  assert(write_trylock(&rw) == false);
+  read_unlock(&rw);
+  read_unlock(&rw);
+  assert(write_trylock(&rw) == true);
+  assert(rw.lock == RWLOCK_WRITER);
+  write_unlock(&rw);
+  write_lock(&rw);
+  write_unlock(&rw);
+  assert(rw.lock == 0);
+  return true;
+}
+#endif
+
+void test_lock() {
+#ifdef CFG_RUN_LIB_LOCK_TEST
+  unittest(test_spin_trylock, "LIB", "Lock - spin_trylock");
+  unittest(test_atomic, "LIB", "Lock - atomic");
+  unittest(test_rwlock, "LIB", "Lock - rwlock");
+#endif
+}
@@ -13,9 +13,9 @@ int strcmp(const char *x, const char *y) {
 }
 
 int strncmp(const char *x, const char *y, size_t n) {
-  while (n--) {
-    if (*x != *y)
-      return 1;
+  for (; n > 0; n--, x++, y++) {
+    if (*x != *y || *x == '\0')
+      return *(const unsigned char *)x - *(const unsigned char *)y;
   }
   return 0;
 }
@@ -111,6 +111,16 @@ bool test_strchr() {
   return true;
 }
 
+bool test_strncmp() {
+  assert(strncmp("abc", "abd", 2) == 0);
+  assert(strncmp("abc", "abd", 3) < 0);
+  assert(strncmp("abd", "abc", 3) > 0);
+  assert(strncmp("ab", "abc", 3) != 0);
+  assert(strncmp("ab", "ab", 8) == 0);
+  assert(strncmp("x", "y", 0) == 0);
+  return true;
+}
+
 bool test_ignore_leading() {
   {
     char *str = "aad";
@@ -134,6 +144,7 @@ bool test_ignore_leading() {
 void test_string() {
 #ifdef CFG_RUN_LIB_STRING_TEST
   unittest(test_strchr, "LIB", "String - strchr");
+  unittest(test_strncmp, "LIB", "String - strncmp");
   unittest(test_ignore_leading, "LIB", "String - ignore_leading");
 
 #endif
@@ -3,6 +3,7 @@
 #include "log.h"
 #include "mm.h"
 #include "mm/startup.h"
+#include "spinlock.h"
 #include "uart.h"
 #include <stddef.h>
 
@@ -15,6 +16,9 @@ static const int _DO_LOG = 0;
 struct AllocationManager KAllocManager;
 struct Frame Frames[1 << BUDDY_MAX_EXPONENT];
 
+// Allocators are shared by all cores
+static spinlock_t kalloc_lock = SPINLOCK_INIT("kalloc");
+
 void KAllocManager_run_example() {
   void *a[30];
   uart_println("[Example] Allocate 5 single frames:");
@@ -63,36 +67,44 @@ void KAllocManager_init() {
   }
 }
 
-void KAllocManager_show_status() { buddy_dump(&KAllocManager.frame_allocator); }
+void KAllocManager_show_status() {
+  buddy_dump(&KAllocManager.frame_allocator);
+  spin_lock_report(&kalloc_lock);
+}
 
 void *kalloc(int size) {
-  void *addr;
+  void *addr = NULL;
+  spin_lock(&kalloc_lock);
   if (size <= (1 << SLAB_OBJ_MAX_SIZE_EXP)) {
     for (int i = SLAB_OBJ_MIN_SIZE_EXP; i < SLAB_OBJ_MAX_SIZE_EXP; i++) {
       if (size < 1 << i) {
         log_println("Allocation from slab allocator, size: %d", size);
         addr = slab_alloc(
             &KAllocManager.obj_allocator_list[i - SLAB_OBJ_MIN_SIZE_EXP]);
-        return addr;
+        goto kalloc_end;
       }
     }
   }
   // allcation using buddy system
   for (int i = 0; i < BUDDY_MAX_EXPONENT; i++) {
-    if ((i << FRAME_SHIFT) >= size) {
+    if ((1 << (i + FRAME_SHIFT)) >= size) {
       Frame *frame = buddy_alloc(&KAllocManager.frame_allocator, i);
       log_println("Allocate Request exp:%d", i);
       log_println("Allocated addr:%x, frame_idx:%d", frame->addr,
                   frame->arr_index);
-      return frame->addr;
+      addr = frame->addr;
+      goto kalloc_end;
     }
   }
-  return NULL;
+kalloc_end:
+  spin_unlock(&kalloc_lock);
+  return addr;
 }
 void kfree(void *addr) {
   // Get frame from address provided
   int arr_index = (long)(addr - MEMORY_START) >> FRAME_SHIFT;
   Frame *frame = &Frames[arr_index];
+  spin_lock(&kalloc_lock);
   if (frame->slab_allocator) {
     slab_free(addr);
   } else {
@@ -100,4 +112,5 @@ void kfree(void *addr) {
                 frame->arr_index);
     buddy_free(&KAllocManager.frame_allocator, frame);
   }
+  spin_unlock(&kalloc_lock);
 }
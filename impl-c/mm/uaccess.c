@@ -0,0 +1,200 @@
+#include "mm/uaccess.h"
+#include "proc/exec.h"
+#include "proc/task.h"
+
+#include "config.h"
+#include "errno.h"
+#include "test.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define WORD_SIZE sizeof(uint64_t)
+#define ONES 0x0101010101010101ULL
+#define HIGHS 0x8080808080808080ULL
+
+// Some byte of the word is zero
+static inline bool has_zero(uint64_t v) { return ((v - ONES) & ~v & HIGHS); }
+
+static inline bool aligned(const void *a, const void *b) {
+  return (((uintptr_t)a | (uintptr_t)b) & (WORD_SIZE - 1)) == 0;
+}
+
+// Bytes which could be read from p without going past end or count
+static inline long readable(const void *p, uintptr_t end, long count) {
+  uintptr_t left = end - (uintptr_t)p;
+  return left < (uintptr_t)count ? (long)left : count;
+}
+
+/**
+ * @brief Find the user region of the current task holding addr
+ * @param end end of the region (exclusive), UINTPTR_MAX for a trusted caller
+ * @retval false if addr is not user memory
+ */
+static bool user_region(const void *addr, uintptr_t *end) {
+  struct task_struct *cur = get_current();
+  uintptr_t a = (uintptr_t)addr;
+  // Boot code or kernel thread, pointers are from the kernel
+  if (cur == NULL || (cur->code == NULL && cur->user_stack == 0)) {
+    *end = UINTPTR_MAX;
+    return true;
+  }
+  if (cur->code != NULL) {
+    uintptr_t base = (uintptr_t)cur->code->addr;
+    if (a >= base && a < base + EXEC_CODE_SIZE) {
+      *end = base + EXEC_CODE_SIZE;
+      return true;
+    }
+  }
+  if (cur->user_stack != 0 && a >= cur->user_stack &&
+      a < cur->user_stack + USER_STACK_SIZE) {
+    *end = cur->user_stack + USER_STACK_SIZE;
+    return true;
+  }
+  return false;
+}
+
+bool access_ok(const void *addr, size_t size) {
+  uintptr_t end;
+  if (!user_region(addr, &end)) {
+    return false;
+  }
+  return size <= end - (uintptr_t)addr;
+}
+
+void copy_words(void *to, const void *from, size_t n) {
+  char *d = to;
+  const char *s = from;
+  if (aligned(d, s)) {
+    for (; n >= WORD_SIZE; n -= WORD_SIZE) {
+      *(uint64_t *)d = *(const uint64_t *)s;
+      d += WORD_SIZE, s += WORD_SIZE;
+    }
+  }
+  for (; n > 0; n--) {
+    *d++ = *s++;
+  }
+}
+
+int copy_from_user(void *to, const void *from, size_t n) {
+  if (!access_ok(from, n)) {
+    return -EFAULT;
+  }
+  copy_words(to, from, n);
+  return 0;
+}
+
+int copy_to_user(void *to, const void *from, size_t n) {
+  if (!access_ok(to, n)) {
+    return -EFAULT;
+  }
+  copy_words(to, from, n);
+  return 0;
+}
+
+long strncpy_from_user(char *dst, const char *src, long count) {
+  uintptr_t end;
+  long n = 0, limit;
+  if (count <= 0) {
+    return 0;
+  }
+  if (!user_region(src, &end)) {
+    return -EFAULT;
+  }
+  // Never read past the region, even when looking for the NUL
+  limit = readable(src, end, count);
+
+  // A word at a time until the word holding the NUL
+  if (aligned(dst, src)) {
+    for (; n + (long)WORD_SIZE <= limit; n += WORD_SIZE) {
+      uint64_t v = *(const uint64_t *)(src + n);
+      if (has_zero(v)) {
+        break;
+      }
+      *(uint64_t *)(dst + n) = v;
+    }
+  }
+  for (; n < limit; n++) {
+    if ((dst[n] = src[n]) == '\0') {
+      return n;
+    }
+  }
+  // Truncated, unless the region ends before the string does
+  return n == count ? count : -EFAULT;
+}
+
+long strnlen_user(const char *s, long count) {
+  uintptr_t end;
+  long n = 0, limit;
+  if (count <= 0) {
+    return count + 1;
+  }
+  if (!user_region(s, &end)) {
+    return 0;
+  }
+  limit = readable(s, end, count);
+  if (((uintptr_t)s & (WORD_SIZE - 1)) == 0) {
+    for (; n + (long)WORD_SIZE <= limit; n += WORD_SIZE) {
+      if (has_zero(*(const uint64_t *)(s + n))) {
+        break;
+      }
+    }
+  }
+  for (; n < limit; n++) {
+    if (s[n] == '\0') {
+      return n + 1;
+    }
+  }
+  return n == count ? count + 1 : 0;
+}
+
+#ifdef CFG_RUN_MM_UACCESS_TEST
+bool test_copy_words() {
+  uint64_t src[4] = {1, 2, 3, 0x0102030405060708ULL};
+  uint64_t dst[4] = {0};
+  copy_words(dst, src, sizeof(src));
+  for (int i = 0; i < 4; i++) {
+    assert(dst[i] == src[i]);
+  }
+  // Misaligned, byte by byte
+  char bytes[9] = {0};
+  copy_words(bytes + 1, (char *)src + 3, 7);
+  assert(bytes[0] == 0);
+  assert(bytes[1] == ((char *)src)[3]);
+  assert(bytes[7] == ((char *)src)[9]);
+  return true;
+}
+
+bool test_strncpy_from_user() {
+  // Word aligned, NUL in the second word
+  uint64_t src_words[3];
+  uint64_t dst_words[3];
+  char *src = (char *)src_words, *dst = (char *)dst_words;
+  for (int i = 0; i < 11; i++) {
+    src[i] = 'a' + i;
+  }
+  src[11] = '\0';
+  assert(strncpy_from_user(dst, src, 24) == 11);
+  for (int i = 0; i <= 11; i++) {
+    assert(dst[i] == src[i]);
+  }
+  // Truncated
+  assert(strncpy_from_user(dst, src, 5) == 5);
+  assert(dst[4] == 'e');
+  // Empty string
+  assert(strncpy_from_user(dst, "", 8) == 0);
+  assert(dst[0] == '\0');
+
+  assert(strnlen_user(src, 24) == 12);
+  assert(strnlen_user(src, 11) == 12);
+  assert(strnlen_user("", 8) == 1);
+  return true;
+}
+#endif
+
+void test_uaccess() {
+#ifdef CFG_RUN_MM_UACCESS_TEST
+  unittest(test_copy_words, "mm", "uaccess copy words");
+  unittest(test_strncpy_from_user, "mm", "uaccess strncpy_from_user");
+#endif
+}
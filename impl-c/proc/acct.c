@@ -0,0 +1,146 @@
+#include "proc/acct.h"
+#include "proc/pid.h"
+#include "proc/task.h"
+
+#include "mm/uaccess.h"
+#include "syscall.h"
+#include "timer.h"
+#include "uart.h"
+
+#include <stddef.h>
+
+// Number of tasks shown by acct_show_top
+#define ACCT_TOP_NR 16
+
+static uint64_t ticks_to_us(uint64_t ticks) {
+  uint64_t freq = timer_el0_get_freq();
+  return ticks / freq * 1000000 + ticks % freq * 1000000 / freq;
+}
+
+void acct_task_init(struct task_struct *task) {
+  task->rusage = (struct task_rusage){0};
+  task->child_rusage = (struct task_rusage){0};
+  task->acct_stamp = timer_el0_get_cnt();
+}
+
+void acct_enter_kernel() {
+  struct task_struct *cur = get_current();
+  uint64_t now = timer_el0_get_cnt();
+  cur->rusage.utime += now - cur->acct_stamp;
+  cur->acct_stamp = now;
+}
+
+void acct_exit_kernel() {
+  struct task_struct *cur = get_current();
+  uint64_t now = timer_el0_get_cnt();
+  cur->rusage.stime += now - cur->acct_stamp;
+  cur->acct_stamp = now;
+}
+
+void acct_switch(struct task_struct *prev, struct task_struct *next,
+                 bool voluntary) {
+  uint64_t now = timer_el0_get_cnt();
+  prev->rusage.stime += now - prev->acct_stamp;
+  if (voluntary) {
+    prev->rusage.nvcsw++;
+  } else {
+    prev->rusage.nivcsw++;
+  }
+  next->acct_stamp = now;
+}
+
+static void rusage_add(struct task_rusage *to, const struct task_rusage *from) {
+  to->utime += from->utime;
+  to->stime += from->stime;
+  to->nvcsw += from->nvcsw;
+  to->nivcsw += from->nivcsw;
+  to->nsyscalls += from->nsyscalls;
+}
+
+void acct_reap(struct task_struct *parent, struct task_struct *child) {
+  rusage_add(&parent->child_rusage, &child->rusage);
+  rusage_add(&parent->child_rusage, &child->child_rusage);
+}
+
+int sys_getrusage(int who, struct rusage *usage) {
+  struct task_struct *cur = get_current();
+  const struct task_rusage *ru;
+  struct rusage out;
+  if (who == RUSAGE_SELF) {
+    ru = &cur->rusage;
+  } else if (who == RUSAGE_CHILDREN) {
+    ru = &cur->child_rusage;
+  } else {
+    return -1;
+  }
+  out.utime_us = ticks_to_us(ru->utime);
+  out.stime_us = ticks_to_us(ru->stime);
+  out.nvcsw = ru->nvcsw;
+  out.nivcsw = ru->nivcsw;
+  out.nsyscalls = ru->nsyscalls;
+  return copy_to_user(usage, &out, sizeof(out));
+}
+
+struct top_entry {
+  int pid;
+  int status;
+  int cpu;
+  struct task_rusage ru;
+};
+
+struct top_list {
+  int nr_tasks; // all tasks seen
+  int nr;       // entries kept, sorted by cpu time descending
+  struct top_entry entries[ACCT_TOP_NR];
+};
+
+static inline uint64_t cpu_time(const struct top_entry *e) {
+  return e->ru.utime + e->ru.stime;
+}
+
+// Runs under the pid map lock, only copy what's needed for printing
+static void top_collect(struct task_struct *task, void *arg) {
+  struct top_list *top = arg;
+  struct top_entry e = {
+      .pid = task->id,
+      .status = task->status,
+      .cpu = task->cpu,
+      .ru = task->rusage,
+  };
+  top->nr_tasks++;
+  int i = top->nr < ACCT_TOP_NR ? top->nr++ : ACCT_TOP_NR;
+  for (; i > 0 && cpu_time(&top->entries[i - 1]) < cpu_time(&e); i--) {
+    if (i < ACCT_TOP_NR) {
+      top->entries[i] = top->entries[i - 1];
+    }
+  }
+  if (i < ACCT_TOP_NR) {
+    top->entries[i] = e;
+  }
+}
+
+static const char *status_name(int status) {
+  switch (status) {
+  case TASK_STATUS_ALIVE:
+    return "R";
+  case TASK_STATUS_SLEEPING:
+    return "S";
+  default:
+    return "Z";
+  }
+}
+
+void acct_show_top() {
+  struct top_list top = {.nr_tasks = 0, .nr = 0};
+  pid_for_each(top_collect, &top);
+
+  uart_println("%d tasks, top %d by cpu time", top.nr_tasks, top.nr);
+  uart_println("PID S CPU USR(ms) SYS(ms) VCSW IVCSW SYSCALLS");
+  for (int i = 0; i < top.nr; i++) {
+    struct top_entry *e = &top.entries[i];
+    uart_println("%d %s %d %d %d %d %d %d", e->pid, status_name(e->status),
+                 e->cpu, (int)(ticks_to_us(e->ru.utime) / 1000),
+                 (int)(ticks_to_us(e->ru.stime) / 1000), (int)e->ru.nvcsw,
+                 (int)e->ru.nivcsw, (int)e->ru.nsyscalls);
+  }
+}
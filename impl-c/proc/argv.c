@@ -1,4 +1,7 @@
-#include "mm.h"
+#include "proc/argv.h"
+
+#include "mm/frame.h"
+#include "mm/uaccess.h"
 #include "string.h"
 #include "uart.h"
 
@@ -17,155 +20,149 @@ static const int _DO_LOG = 0;
 // sp value must be 16 bytes aligned
 #define SP_ALIGN 16
 
+// Bytes of the user stack that argv/envp may take
+#define ARGV_SPACE_MAX 2048
+
 static inline uintptr_t align_up(uintptr_t n, unsigned long align) {
   return (n + align - 1) & (~(align - 1));
 }
 
-/**
- * @brief Place argv into user stack
- * @param src_sp the original user sp value
- * @param src_argv argv to copy from
- * @param ret_argc (total argc count)
- * @param ret_argv (alt)
- * @param ret_sp new sp value
- */
-void place_args(/*IN*/ uintptr_t src_sp,
-                /*IN*/ const char **src_argv,
-                /*OUT*/ int *ret_argc,
-                /*OUT*/ char ***ret_argv,
-                /*OUT*/ uintptr_t *ret_sp) {
-
-  log_println("[place_arg] src_sp:%x", src_sp);
-
-  int nm_args = 0;
-  while (src_argv[nm_args] != NULL) {
-    log_println(" src_argv[%d](%x):`%s`", nm_args, src_argv[nm_args],
-                src_argv[nm_args]);
-    nm_args++;
-  }
-
-  if (ret_argc != NULL) {
-    *ret_argc = nm_args;
-  }
-
-  // Save Arguments into kernel memory.
-  // We need to backup argv since they are stored in the user stack,
-  //  which would be overwritten by following operations.
-  char **saved_args = (char **)kalloc(sizeof(char *) * nm_args);
-  char *arg_str = NULL;
-
-  for (int i = 0; i < nm_args; i++) {
-    arg_str = (char *)kalloc(sizeof(char) * (strlen(src_argv[i]) + 1));
-    strcpy(arg_str, src_argv[i]);
-    saved_args[i] = arg_str;
-  }
+static inline uintptr_t align_down(uintptr_t n, unsigned long align) {
+  return n & (~(align - 1));
+}
 
-  /**
-   * Save argv into user stack.
-   *
-   * High
-   * | "str2"  | <- `args_offset[2]` / old stack top
-   * | "str1"  | <- `args_offset[1]`
-   * | "str0"  | <- `args_offset[0]`
-   * | argv[2] |
-   * | argv[1] |
-   * | argv[0] |
-   * |stack_top| <- new user stack
-   * Low
-   */
-
-  // Calculate total size to store in user stack
-  // size is calculated in byte
-  size_t *args_offset = kalloc(sizeof(size_t) * nm_args);
-  size_t size_byte = 0, _size = 0;
-
-  // Size for **argv array
-  _size = sizeof(char **) * nm_args;
-  _size = align_up(_size, SP_ALIGN);
-  size_byte += _size;
-  args_offset[0] = size_byte;
-  log_println("[place_arg] size for argv array: %d(byte)", _size);
-
-  // Size for each argv string
-  for (int i = 0; i < nm_args; i++) {
-    _size = strlen(saved_args[i]) + 1;
-    _size = align_up(_size, SP_ALIGN);
-    size_byte += _size;
-    args_offset[i + 1] = size_byte;
-    log_println("[place_arg] size for src_argv[%d]: %d(byte)", i, _size);
-  }
+// Fetch vec[i] from the caller
+// @retval 0 on success, -EFAULT if vec is not accessible
+static int get_arg(char *const vec[], int i, const char **arg) {
+  return copy_from_user(arg, &vec[i], sizeof(*arg));
+}
 
-  for (int i = 0; i < nm_args; i++) {
-    log_println(" args_offset[%d] -> %d", i, args_offset[i]);
+// Count strings of a NULL terminated vector and add the bytes they take
+static int measure(char *const vec[], int *count, size_t *bytes) {
+  const char *str;
+  long len;
+  *count = 0;
+  if (vec == NULL) {
+    return 0;
   }
-
-  log_println("total bytes -> %d", size_byte);
-
-  // The new user sp value (byte-addressable)
-  {
-    size_t aligned = align_up(size_byte, SP_ALIGN);
-    log_println("[place arg] total bytes:%d, after alignment:%d", size_byte,
-                aligned);
-    size_byte = aligned;
+  while (1) {
+    if (*count > ARGV_MAX || get_arg(vec, *count, &str) != 0) {
+      return -1;
+    }
+    if (str == NULL) {
+      return 0;
+    }
+    len = strnlen_user(str, ARGV_STR_MAX);
+    if (len == 0 || len > ARGV_STR_MAX) {
+      return -1;
+    }
+    *bytes += len;
+    (*count)++;
   }
+}
 
-  // 1. sp grow from HIGH->LOW
-  // 2. sp point to an empty memory space
-  int base = SP_ALIGN;
-
-  uintptr_t sp = src_sp;
-  sp -= size_byte;
-  log_println("[place arg] move sp(%x) -> sp(%x)", src_sp, sp);
-
-  // Calculate directly in byte address
-  char **user_argv = (char **)(sp + base);
-  for (int i = 0; i < nm_args; i++) {
-    user_argv[i] = (char *)(sp + base + args_offset[i]);
+// Copy strings of vec upward from *cursor, store their address into ptrs
+static int copy_strings(char *const vec[], int count, char **ptrs,
+                        char **cursor, char *end) {
+  const char *str;
+  long len;
+  for (int i = 0; i < count; i++) {
+    if (get_arg(vec, i, &str) != 0) {
+      return -1;
+    }
+    len = strncpy_from_user(*cursor, str, end - *cursor);
+    // No room for the NUL: changed since measured
+    if (len < 0 || len == end - *cursor) {
+      return -1;
+    }
+    log_println("[place_arg] %x -> `%s`", *cursor, *cursor);
+    ptrs[i] = *cursor;
+    *cursor += len + 1;
   }
+  ptrs[count] = NULL;
+  return 0;
+}
 
-  // Copy args to user stack (would overwrite existing data)
-  for (int i = 0; i < nm_args; i++) {
-    strcpy((char *)(sp + base + args_offset[i]), saved_args[i]);
-    log_println("[place arg] argv[%d](%x) written -> %s", i,
-                sp + base + args_offset[i], sp + base + args_offset[i]);
-    // log_println("src_argv[%d] => %x", i, saved_args[i]);
+int place_args(/*IN*/ uintptr_t stack_top,
+               /*IN*/ char *const argv[],
+               /*IN*/ char *const envp[],
+               /*IN*/ uintptr_t entry,
+               /*OUT*/ struct user_args *out) {
+  int argc, envc;
+  size_t str_bytes = 0;
+  if (measure(argv, &argc, &str_bytes) != 0 ||
+      measure(envp, &envc, &str_bytes) != 0) {
+    return -1;
   }
 
-  if (ret_argv != NULL) {
-    *ret_argv = (char **)(sp + base);
+  // argc, argv, envp and auxv in words
+  size_t nr_words = 1 + (argc + 1) + (envc + 1) + 2 * AUXV_NR;
+  char *cursor = (char *)(stack_top - str_bytes);
+  uintptr_t sp = align_down((uintptr_t)cursor - nr_words * 8, SP_ALIGN);
+  if (stack_top - sp > ARGV_SPACE_MAX) {
+    return -1;
   }
-  if (ret_sp != NULL) {
-    *ret_sp = sp;
+  log_println("[place_arg] argc:%d envc:%d, sp:%x -> %x", argc, envc,
+              stack_top, sp);
+
+  uint64_t *words = (uint64_t *)sp;
+  words[0] = argc;
+  out->argc = argc;
+  out->argv = (char **)&words[1];
+  out->envp = out->argv + argc + 1;
+  out->auxv = (uint64_t *)(out->envp + envc + 1);
+  out->sp = sp;
+
+  if (copy_strings(argv, argc, out->argv, &cursor, (char *)stack_top) != 0 ||
+      copy_strings(envp, envc, out->envp, &cursor, (char *)stack_top) != 0) {
+    return -1;
   }
 
-  // Caution: need to be freed.
-  kfree(args_offset);
-  for (int i = 0; i < nm_args; i++) {
-    kfree(saved_args[i]);
-  }
-  kfree(saved_args);
+  uint64_t *aux = out->auxv;
+  *aux++ = AT_PAGESZ, *aux++ = FRAME_SIZE;
+  *aux++ = AT_ENTRY, *aux++ = entry;
+  *aux++ = AT_HWCAP, *aux++ = HWCAP_FP | HWCAP_ASIMD;
+  *aux++ = AT_NULL, *aux++ = 0;
+  return 0;
 }
 
 #ifdef CFG_RUN_PROC_ARGV_TEST
 bool test_good() {
   char *src_argv[] = {"hello_world.out", "--name", "ian", NULL};
-  char stack[400];
-
-  uintptr_t src_sp = align_up((uintptr_t)&stack[350], SP_ALIGN);
-  uintptr_t new_sp;
-
-  char **new_argv;
-  int argc;
-
-  place_args(src_sp, (const char **)src_argv, &argc, &new_argv, &new_sp);
-  assert((new_sp % SP_ALIGN) == 0);
-  assert(new_sp < src_sp);
-  assert(argc == 3);
-  for (size_t i = 0; i < argc; i++) {
-    assert((new_sp < (uintptr_t)new_argv[i]));
-    // sp point to an empty memory space
-    assert(((uintptr_t)new_argv[i] < (src_sp + SP_ALIGN)));
+  char *src_envp[] = {"HOME=/", NULL};
+  uint64_t stack[64];
+  uintptr_t top = (uintptr_t)&stack[64];
+  struct user_args args;
+
+  assert(place_args(top, src_argv, src_envp, 0x80000, &args) == 0);
+  assert((args.sp % SP_ALIGN) == 0);
+  assert(args.sp < top);
+  assert(*(uint64_t *)args.sp == 3);
+  assert(args.argc == 3);
+  assert(args.argv == (char **)(args.sp + 8));
+  for (int i = 0; i < args.argc; i++) {
+    assert(!strcmp(args.argv[i], src_argv[i]));
+    // strings are above the pointer arrays
+    assert((uintptr_t)args.argv[i] > (uintptr_t)args.auxv);
+    assert((uintptr_t)args.argv[i] < top);
   }
+  assert(args.argv[3] == NULL);
+  assert(!strcmp(args.envp[0], "HOME=/"));
+  assert(args.envp[1] == NULL);
+  assert(args.auxv[0] == AT_PAGESZ);
+  assert(args.auxv[3] == 0x80000);
+  assert(args.auxv[2 * AUXV_NR - 2] == AT_NULL);
+  return true;
+}
+
+bool test_no_envp() {
+  char *src_argv[] = {"a", NULL};
+  uint64_t stack[32];
+  struct user_args args;
+  assert(place_args((uintptr_t)&stack[32], src_argv, NULL, 0, &args) == 0);
+  assert(args.argc == 1);
+  assert(args.envp[0] == NULL);
+  assert(args.auxv == (uint64_t *)&args.envp[1]);
   return true;
 }
 #endif
@@ -173,5 +170,6 @@ bool test_good() {
 void test_argv_parse() {
 #ifdef CFG_RUN_PROC_ARGV_TEST
   unittest(test_good, "proc", "argv");
+  unittest(test_no_envp, "proc", "argv without envp");
 #endif
-}
\ No newline at end of file
+}
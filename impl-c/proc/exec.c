@@ -1,10 +1,17 @@
 #include "proc/exec.h"
+#include "proc/acct.h"
 #include "proc/argv.h"
+#include "proc/fpsimd.h"
+#include "proc/kthread.h"
+#include "proc/sched.h"
 #include "proc/task.h"
+#include "proc/trace.h"
 
 #include "dev/cpio.h"
+#include "fs/vfs.h"
 #include "mm.h"
 #include "mm/frame.h"
+#include "mm/uaccess.h"
 #include "stddef.h"
 #include "stdint.h"
 #include "timer.h"
@@ -19,43 +26,103 @@ static const int _DO_LOG = 1;
 static const int _DO_LOG = 0;
 #endif
 
+// A compressed initramfs is only unpacked into tmpfs, read the program there
+static void *load_program_vfs(const char *name, /*ret*/ size_t *target_size) {
+  struct file *f = vfs_open(name, 0);
+  unsigned char *load_addr;
+  size_t size = 0;
+  int n;
+  char more;
+  if (f == NULL) {
+    uart_println("[Loader]Cannot found `%s` under rootfs", name);
+    return NULL;
+  }
+  load_addr = (unsigned char *)kalloc(EXEC_CODE_SIZE);
+  while (size < EXEC_CODE_SIZE &&
+         (n = vfs_read(f, load_addr + size, EXEC_CODE_SIZE - size)) > 0) {
+    size += n;
+  }
+  if (size == EXEC_CODE_SIZE && vfs_read(f, &more, 1) > 0) {
+    uart_println("[Loader]`%s` is too large", name);
+    kfree(load_addr);
+    load_addr = NULL;
+  } else if (target_size != NULL) {
+    *target_size = size;
+  }
+  vfs_close(f);
+  return load_addr;
+}
+
 // load program into a seperate memory space
 void *load_program(const char *name, /*ret*/ size_t *target_size) {
   unsigned long size;
   uint8_t *file = (uint8_t *)cpioGetFile((void *)RAMFS_ADDR, name, &size);
   if (file == NULL) {
-    uart_println("[Loader]Cannot found `%s` under rootfs", name);
+    return load_program_vfs(name, target_size);
+  }
+  if (size > EXEC_CODE_SIZE) {
+    uart_println("[Loader]`%s` is too large: %d bytes", name, (int)size);
     return NULL;
   }
   if (target_size != NULL) {
     *target_size = size;
   }
-  unsigned char *load_addr = (unsigned char *)kalloc(FRAME_SIZE);
-  for (unsigned long i = 0; i < size; i++) {
-    load_addr[i] = file[i];
-  }
+  unsigned char *load_addr = (unsigned char *)kalloc(EXEC_CODE_SIZE);
+  copy_words(load_addr, file, size);
   return load_addr;
 }
 
-void exec_user(const char *name, char *const argv[]) {
-  struct task_struct *task = get_current();
-  log_println("[exec] name:%s cur_task: %d(%x)", name, task->id, task);
+void task_code_put(struct task_code *code) {
+  if (code == NULL || !atomic_dec_and_test(&code->refcnt)) {
+    return;
+  }
+  log_println("[exec] free program code: %x", code->addr);
+  kfree(code->addr);
+  kfree(code);
+}
+
+/**
+ * @brief Load a program and build its user stack with argv
+ *  The calling task is left untouched, so the image could be installed into
+ *  either the current task (exec) or a new one (spawn).
+ * @retval 0 for success, -1 if the program is not found or the arguments
+ *  are not accessible
+ */
+int exec_prepare(const char *name, char *const argv[], char *const envp[],
+                 /*OUT*/ struct exec_image *img) {
+  char path[VFS_PATH_MAX];
+  long len = strncpy_from_user(path, name, VFS_PATH_MAX);
+  if (len < 0 || len == VFS_PATH_MAX) {
+    return -1;
+  }
 
   // load new program into memory
   size_t code_size;
-  void *entry_point = load_program(name, &code_size);
+  void *entry_point = load_program(path, &code_size);
+  if (entry_point == NULL) {
+    return -1;
+  }
   log_println("[exec] load new program code at: %x", entry_point);
+  img->code = kalloc(sizeof(struct task_code));
+  atomic_set(&img->code->refcnt, 1);
+  img->code->addr = entry_point;
+  img->code->size = code_size;
 
   // allocate a new user stack to use
-  uintptr_t user_stack = (uintptr_t)kalloc(FRAME_SIZE);
-  uintptr_t user_sp = user_stack + FRAME_SIZE;
+  img->user_stack = (uintptr_t)kalloc(USER_STACK_SIZE);
+  uintptr_t user_sp = img->user_stack + USER_STACK_SIZE;
 
   // place args onto the newly allocated user stack
-  int argc;
-  char **user_argv;
-  uintptr_t new_sp;
-  place_args(user_sp, argv, &argc, &user_argv, &new_sp);
+  if (place_args(user_sp, argv, envp, (uintptr_t)entry_point,
+                 &img->args) != 0) {
+    task_code_put(img->code);
+    kfree((void *)img->user_stack);
+    return -1;
+  }
+  return 0;
+}
 
+void exec_install(struct task_struct *task, struct exec_image *img) {
   // Caller of this function is either
   //  1. a kernel thread with a user thread called sys_exec
   // or
@@ -68,31 +135,82 @@ void exec_user(const char *name, char *const argv[]) {
     if (task->user_stack != (uintptr_t)NULL) {
       kfree((void *)task->user_stack);
     }
-    // unload previous task code
-    if (task->code != NULL) {
-      log_println("[exec] free code from previous process: %x", task->code);
-      kfree((void *)task->code);
-    }
+    // unload previous task code (unless still used by forked tasks)
+    task_code_put(task->code);
+    // the new program starts with a clean FP/SIMD state
+    fpsimd_release(task);
   }
 
-  task->user_stack = user_stack;
-  task->user_sp = new_sp;
-  task->code = entry_point;
-  task->code_size = code_size;
+  task->user_stack = img->user_stack;
+  task->user_sp = img->args.sp;
+  task->code = img->code;
+}
 
+void exec_enter_user(struct task_struct *task, const struct user_args *args) {
   // context under kernel mode
-  task->cpu_context.fp = task->kernel_stack + FRAME_SIZE;
-  task->cpu_context.lr = (uint64_t)entry_point;
-  task->cpu_context.sp = task->kernel_stack + FRAME_SIZE;
-
-  // Jump into user mode
-  asm volatile("mov x0, 0x340  \n"); // enable core timer interrupt
-  asm volatile("msr spsr_el1, x0  \n");
-  asm volatile("msr sp_el0, %0    \n" ::"r"(task->user_sp));
-  asm volatile("msr elr_el1, %0   \n" ::"r"(task->cpu_context.lr));
-
-  asm volatile("mov x0, %0 \n\
-                mov x1, %1 \n\
-                eret" ::"r"(argc),
-               "r"(user_argv));
-}
\ No newline at end of file
+  task->cpu_context.fp = task->kernel_stack + kstack_size(task->stack_order);
+  task->cpu_context.lr = (uint64_t)task->code->addr;
+  task->cpu_context.sp = task->kernel_stack + kstack_size(task->stack_order);
+
+  // Never returns to syn_handler, close the kernel slice here
+  acct_exit_kernel();
+
+  // Jump into user mode, with x0: argc, x1: argv, x2: envp
+  register uint64_t x0 asm("x0") = args->argc;
+  register uint64_t x1 asm("x1") = (uint64_t)args->argv;
+  register uint64_t x2 asm("x2") = (uint64_t)args->envp;
+  asm volatile("msr spsr_el1, %0  \n" // enable core timer interrupt
+               "msr sp_el0, %1    \n"
+               "msr elr_el1, %2   \n"
+               "eret              \n" ::"r"(0x340),
+               "r"(task->user_sp), "r"(task->cpu_context.lr), "r"(x0),
+               "r"(x1), "r"(x2));
+}
+
+void exec_user(const char *name, char *const argv[], char *const envp[]) {
+  struct task_struct *task = get_current();
+  struct exec_image img;
+  log_println("[exec] name:%x cur_task: %d(%x)", name, task->id, task);
+
+  if (exec_prepare(name, argv, envp, &img) != 0) {
+    return;
+  }
+  exec_install(task, &img);
+  exec_enter_user(task, &img.args);
+}
+
+// Entry of a spawned task, arg: the exec_image installed by sys_spawn
+static void spawn_entry(struct exec_image *img) {
+  struct user_args args = img->args;
+  kfree(img);
+  exec_enter_user(get_current(), &args);
+}
+
+int sys_spawn(const char *name, char *const argv[], char *const envp[]) {
+  struct task_struct *parent = get_current();
+  struct exec_image *img = kalloc(sizeof(struct exec_image));
+  log_println("[spawn] name:%x parent: %d", name, parent->id);
+
+  // Build the image straight from the caller's argv, nothing is copied from
+  // the parent's stacks
+  if (exec_prepare(name, argv, envp, img) != 0) {
+    kfree(img);
+    return -1;
+  }
+  struct task_struct *child = task_alloc(spawn_entry);
+  if (child == NULL) {
+    task_code_put(img->code);
+    kfree((void *)img->user_stack);
+    kfree(img);
+    return -1;
+  }
+  // task_entry passes x20 to spawn_entry
+  child->cpu_context.x20 = (uint64_t)img;
+  exec_install(child, img);
+  task_copy_cwd(child, parent);
+
+  task_add_child(parent, child);
+  trace_record(TRACE_FORK, parent->id, child->id);
+  sched_enqueue(child);
+  return child->id;
+}
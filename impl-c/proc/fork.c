@@ -1,10 +1,15 @@
 #include "proc.h"
+#include "proc/exec.h"
+#include "proc/fpsimd.h"
+#include "proc/sched.h"
 #include "proc/task.h"
+#include "proc/trace.h"
 
 #include "bool.h"
 #include "fs/vfs.h"
 #include "mm.h"
 #include "mm/frame.h"
+#include "mm/uaccess.h"
 #include "string.h"
 #include "syscall.h"
 
@@ -21,6 +26,35 @@ static const int _DO_LOG = 0;
 
 extern void fork_child_eret();
 
+static inline bool in_stack(uint64_t addr, uintptr_t stack) {
+  return addr >= stack && addr < stack + USER_STACK_SIZE;
+}
+
+/**
+ * @brief Point the child's sp_el0 and fp at its own copy of the user stack.
+ *  Without a MMU the copy lives at another address, frame records saved on it
+ *  (fp, lr pairs) are rebased as well so returning frames stay on the copy.
+ */
+static void rebase_user_stack(struct trap_frame *tf, uintptr_t from,
+                              uintptr_t to) {
+  uint64_t delta = to - from, fp;
+  uint64_t *record;
+  tf->regs[31] += delta;
+  if (!in_stack(tf->regs[29], from)) {
+    return;
+  }
+  tf->regs[29] += delta;
+  // Walk up the chain, records are 16 bytes and older ones sit higher
+  for (fp = tf->regs[29]; in_stack(fp, to) && fp + 16 <= to + USER_STACK_SIZE;
+       fp = *record) {
+    record = (uint64_t *)fp;
+    if (!in_stack(*record, from) || *record + delta <= fp) {
+      break;
+    }
+    *record += delta;
+  }
+}
+
 int sys_fork(const struct trap_frame *tf) {
 
   struct task_struct *parent = get_current();
@@ -32,22 +66,30 @@ int sys_fork(const struct trap_frame *tf) {
     log_println("current sp(sp_el1): %x", el1_sp);
   }
 
-  struct task_struct *child = task_create(NULL);
+  // The child is not visible to the scheduler until it's fully built
+  struct task_struct *child = task_alloc(NULL);
+  if (child == NULL) {
+    // Out of PIDs or memory
+    return -1;
+  }
 
   // USER STACK
-  child->user_stack = (uintptr_t)kalloc(FRAME_SIZE);
-  memcpy((char *)child->user_stack, (const char *)parent->user_stack,
-         FRAME_SIZE);
+  child->user_stack = (uintptr_t)kalloc(USER_STACK_SIZE);
+  copy_words((void *)child->user_stack, (const void *)parent->user_stack,
+             USER_STACK_SIZE);
 
   // KERNEL STACK
   memcpy((char *)child->kernel_stack, (const char *)parent->kernel_stack,
          FRAME_SIZE);
 
   // CODE
-  // TODO: fix this (memory leak)
-  // parent should free memory
-  // parent should be collected after child
-  child->code = NULL;
+  // shared with the parent, freed once both exec or exit
+  child->code = task_code_get(parent->code);
+
+  // FP/SIMD
+  fpsimd_fork(child, parent);
+
+  task_copy_cwd(child, parent);
 
   // Child return
   // direct to the exception return point
@@ -55,8 +97,9 @@ int sys_fork(const struct trap_frame *tf) {
   struct trap_frame *child_tf =
       (struct trap_frame *)(child->kernel_stack + kstack_tf_offset);
   child->cpu_context.sp = (uintptr_t)child_tf;
-  child->cpu_context.lr = (uint64_t)fork_child_eret;
+  child->cpu_context.x19 = (uint64_t)fork_child_eret;
   child_tf->regs[0] = 0;
+  rebase_user_stack(child_tf, parent->user_stack, child->user_stack);
 
   log_println("parent kstack:%x ustack:%x", parent->kernel_stack,
               parent->user_stack);
@@ -70,5 +113,8 @@ int sys_fork(const struct trap_frame *tf) {
               child->cpu_context.fp, child->cpu_context.sp,
               child->cpu_context.lr);
 
+  task_add_child(parent, child);
+  trace_record(TRACE_FORK, parent->id, child->id);
+  sched_enqueue(child);
   return child->id;
 }
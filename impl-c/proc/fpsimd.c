@@ -0,0 +1,111 @@
+#include "proc/fpsimd.h"
+#include "proc/smp.h"
+#include "proc/task.h"
+
+#include "fatal.h"
+#include "mm.h"
+#include "string.h"
+
+#include "config.h"
+#include "log.h"
+
+#ifdef CFG_LOG_PROC_FPSIMD
+static const int _DO_LOG = 1;
+#else
+static const int _DO_LOG = 0;
+#endif
+
+static inline void cpacr_set_fpen(uint64_t fpen) {
+  uint64_t cpacr;
+  asm volatile("mrs %0, cpacr_el1 \n" : "=r"(cpacr));
+  cpacr = (cpacr & ~(uint64_t)CPACR_FPEN_MASK) | fpen;
+  asm volatile("msr cpacr_el1, %0 \n"
+               "isb               \n" ::"r"(cpacr)
+               : "memory");
+}
+
+static inline bool trapped_from_el0() {
+  uint64_t spsr;
+  asm volatile("mrs %0, spsr_el1 \n" : "=r"(spsr));
+  return (spsr & 0xf) == 0;
+}
+
+void fpsimd_trap_handler() {
+  struct task_struct *task = get_current();
+  struct cpu_info *cpu = this_cpu();
+
+  if (!trapped_from_el0()) {
+    FATAL("[fpsimd] FP/SIMD used by the kernel outside kernel_fpsimd_begin");
+  }
+  cpacr_set_fpen(CPACR_FPEN_ENABLE);
+
+  if (task->fpsimd == NULL) {
+    // First use, start from a clean register file
+    task->fpsimd = kalloc(sizeof(struct fpsimd_state));
+    uint64_t *raw = (uint64_t *)task->fpsimd;
+    for (size_t i = 0; i < sizeof(struct fpsimd_state) / sizeof(uint64_t);
+         i++) {
+      raw[i] = 0;
+    }
+    log_println("[fpsimd] task %d starts using FP/SIMD", task->id);
+    fpsimd_load_state(task->fpsimd);
+  } else if (cpu->fpsimd_owner != task || task->fpsimd_cpu != cpu->id) {
+    fpsimd_load_state(task->fpsimd);
+  }
+  // Registers of this core now hold the state of the task
+  cpu->fpsimd_owner = task;
+  task->fpsimd_cpu = cpu->id;
+}
+
+void fpsimd_switch_out(struct task_struct *prev) {
+  if (!fpsimd_enabled()) {
+    return;
+  }
+  if (prev->fpsimd != NULL && prev->status != TASK_STATUS_DEAD) {
+    fpsimd_save_state(prev->fpsimd);
+  }
+  cpacr_set_fpen(CPACR_FPEN_TRAP);
+}
+
+void fpsimd_fork(struct task_struct *child, struct task_struct *parent) {
+  if (parent->fpsimd == NULL) {
+    return;
+  }
+  // Registers might be newer than the save area
+  if (fpsimd_enabled()) {
+    fpsimd_save_state(parent->fpsimd);
+  }
+  child->fpsimd = kalloc(sizeof(struct fpsimd_state));
+  memcpy((char *)child->fpsimd, (const char *)parent->fpsimd,
+         sizeof(struct fpsimd_state));
+  child->fpsimd_cpu = -1;
+}
+
+void fpsimd_release(struct task_struct *task) {
+  // Forget about registers left on any core, the task struct might be reused
+  for (int cpuid = 0; cpuid < SMP_NUM_CPUS; cpuid++) {
+    if (cpus[cpuid].fpsimd_owner == task) {
+      cpus[cpuid].fpsimd_owner = NULL;
+    }
+  }
+  if (task == get_current()) {
+    cpacr_set_fpen(CPACR_FPEN_TRAP);
+  }
+  if (task->fpsimd != NULL) {
+    kfree(task->fpsimd);
+    task->fpsimd = NULL;
+  }
+  task->fpsimd_cpu = -1;
+}
+
+void kernel_fpsimd_begin() {
+  struct task_struct *task = get_current();
+  if (fpsimd_enabled() && task->fpsimd != NULL) {
+    fpsimd_save_state(task->fpsimd);
+  }
+  // Registers would be clobbered, the task reloads them on its next use
+  this_cpu()->fpsimd_owner = NULL;
+  cpacr_set_fpen(CPACR_FPEN_ENABLE);
+}
+
+void kernel_fpsimd_end() { cpacr_set_fpen(CPACR_FPEN_TRAP); }
@@ -0,0 +1,150 @@
+#include "proc/kthread.h"
+#include "proc/sched.h"
+#include "proc/task.h"
+
+#include "mm.h"
+#include "mm/frame.h"
+#include "spinlock.h"
+
+#include "config.h"
+#include "log.h"
+#include "test.h"
+
+#ifdef CFG_LOG_PROC_TASK
+static const int _DO_LOG = 1;
+#else
+static const int _DO_LOG = 0;
+#endif
+
+struct kstack_pool {
+  spinlock_t lock;
+  int nr_free;
+  uintptr_t stacks[KSTACK_POOL_SIZE];
+};
+
+static struct kstack_pool kstack_pools[KSTACK_MAX_ORDER + 1] = {
+    [0 ... KSTACK_MAX_ORDER] = {.lock = SPINLOCK_INIT("kstack_pool"),
+                                .nr_free = 0},
+};
+
+uintptr_t kstack_alloc(int order) {
+  if (order < 0 || order > KSTACK_MAX_ORDER) {
+    return (uintptr_t)NULL;
+  }
+  struct kstack_pool *pool = &kstack_pools[order];
+  uintptr_t stack = (uintptr_t)NULL;
+
+  spin_lock(&pool->lock);
+  if (pool->nr_free > 0) {
+    stack = pool->stacks[--pool->nr_free];
+  }
+  spin_unlock(&pool->lock);
+
+  if (stack == (uintptr_t)NULL) {
+    stack = (uintptr_t)kalloc(kstack_size(order));
+    if (stack == (uintptr_t)NULL) {
+      return stack;
+    }
+  }
+  *(uint64_t *)stack = KSTACK_MAGIC;
+  return stack;
+}
+
+void kstack_free(uintptr_t stack, int order) {
+  struct kstack_pool *pool = &kstack_pools[order];
+  spin_lock(&pool->lock);
+  if (pool->nr_free < KSTACK_POOL_SIZE) {
+    pool->stacks[pool->nr_free++] = stack;
+    stack = (uintptr_t)NULL;
+  }
+  spin_unlock(&pool->lock);
+
+  // Pool is full
+  if (stack != (uintptr_t)NULL) {
+    kfree((void *)stack);
+  }
+}
+
+bool kstack_overflowed(struct task_struct *task) {
+  if (task->kernel_stack == (uintptr_t)NULL) {
+    return false;
+  }
+  return *(uint64_t *)task->kernel_stack != KSTACK_MAGIC;
+}
+
+struct task_struct *kthread_create(kthread_fn fn, void *arg, int stack_order) {
+  struct task_struct *t = task_alloc_stack(fn, stack_order);
+  if (t == NULL) {
+    return NULL;
+  }
+  // task_entry passes x20 as the argument of fn
+  t->cpu_context.x20 = (uint64_t)arg;
+  t->joinable = true;
+  log_println("[kthread] create thread %d, stack:%x(order:%d)", t->id,
+              t->kernel_stack, stack_order);
+  sched_enqueue(t);
+  return t;
+}
+
+int kthread_join(struct task_struct *thread, int *ret) {
+  if (thread == NULL || !thread->joinable || thread == get_current()) {
+    return -1;
+  }
+  // Sleep until the thread exits and its context is no longer in use
+  if (task_join(thread) != 0) {
+    return -1;
+  }
+  if (ret != NULL) {
+    *ret = thread->exit_code;
+  }
+  log_println("[kthread] join thread %d, ret:%d", thread->id,
+              thread->exit_code);
+  task_free(thread);
+  return 0;
+}
+
+#ifdef CFG_RUN_PROC_KTHREAD_TEST
+static int test_fn(void *arg) { return *(int *)arg + 1; }
+
+static bool test_kthread_join() {
+  int arg = 41, ret = 0;
+  uintptr_t stack;
+  struct task_struct *t = kthread_create(test_fn, &arg, 1);
+  assert(t != NULL && t->joinable);
+  stack = t->kernel_stack;
+  assert(kthread_join(t, &ret) == 0 && ret == 42);
+
+  // The stack went back to the pool of its order, and is handed out again
+  t = kthread_create(test_fn, &arg, 1);
+  assert(t != NULL && t->kernel_stack == stack);
+  assert(kthread_join(t, NULL) == 0);
+  assert(kthread_join(get_current(), NULL) == -1);
+  return true;
+}
+
+static bool test_kstack_magic() {
+  struct task_struct task = {.kernel_stack = kstack_alloc(0)};
+  assert(task.kernel_stack != (uintptr_t)NULL);
+  assert(*(uint64_t *)task.kernel_stack == KSTACK_MAGIC);
+  assert(!kstack_overflowed(&task));
+
+  // Written below the stack
+  *(uint64_t *)task.kernel_stack = 0;
+  assert(kstack_overflowed(&task));
+
+  // Reused from the pool with the magic written again
+  kstack_free(task.kernel_stack, 0);
+  assert(kstack_alloc(0) == task.kernel_stack);
+  assert(!kstack_overflowed(&task));
+  kstack_free(task.kernel_stack, 0);
+  assert(kstack_alloc(KSTACK_MAX_ORDER + 1) == (uintptr_t)NULL);
+  return true;
+}
+#endif
+
+void test_kthread() {
+#ifdef CFG_RUN_PROC_KTHREAD_TEST
+  unittest(test_kthread_join, "PROC", "kthread - create/join & stack pool");
+  unittest(test_kstack_magic, "PROC", "kthread - stack magic");
+#endif
+}
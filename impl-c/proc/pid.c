@@ -0,0 +1,136 @@
+#include "proc/pid.h"
+
+#include "bool.h"
+#include "config.h"
+#include "test.h"
+
+#include <stddef.h>
+
+PID_MAP_DEFINE(pid_map, PID_MAX);
+
+// Search a zero bit in [from, map->max)
+// @retval -1 if not found
+static int find_free(struct pid_map *map, int from) {
+  int word = from / 64;
+  // Treat bits below `from` in the first word as used
+  uint64_t used = map->bitmap[word] | ((1ULL << (from % 64)) - 1);
+  while (1) {
+    if (~used != 0) {
+      return word * 64 + __builtin_ctzll(~used);
+    }
+    if (++word >= map->max / 64) {
+      return -1;
+    }
+    used = map->bitmap[word];
+  }
+}
+
+int pid_map_alloc(struct pid_map *map, struct task_struct *task) {
+  int pid = -1;
+  spin_lock(&map->lock);
+  if (map->nr_used < map->max) {
+    int from = map->last + 1;
+    if (from >= map->max || (pid = find_free(map, from)) == -1) {
+      pid = find_free(map, 0);
+    }
+    map->bitmap[pid / 64] |= 1ULL << (pid % 64);
+    map->tasks[pid] = task;
+    map->last = pid;
+    map->nr_used++;
+  }
+  spin_unlock(&map->lock);
+  return pid;
+}
+
+void pid_map_free(struct pid_map *map, int pid) {
+  if (pid < 0 || pid >= map->max) {
+    return;
+  }
+  spin_lock(&map->lock);
+  if (map->bitmap[pid / 64] & (1ULL << (pid % 64))) {
+    map->bitmap[pid / 64] &= ~(1ULL << (pid % 64));
+    map->tasks[pid] = NULL;
+    map->nr_used--;
+  }
+  spin_unlock(&map->lock);
+}
+
+struct task_struct *pid_map_lookup(struct pid_map *map, int pid) {
+  if (pid < 0 || pid >= map->max) {
+    return NULL;
+  }
+  // An aligned pointer load is atomic, no need to take the lock
+  return ((struct task_struct *volatile *)map->tasks)[pid];
+}
+
+int pid_alloc(struct task_struct *task) { return pid_map_alloc(&pid_map, task); }
+
+void pid_free(int pid) { pid_map_free(&pid_map, pid); }
+
+struct task_struct *pid_lookup(int pid) { return pid_map_lookup(&pid_map, pid); }
+
+void pid_for_each(void (*fn)(struct task_struct *task, void *arg), void *arg) {
+  spin_lock(&pid_map.lock);
+  for (int word = 0; word < pid_map.max / 64; word++) {
+    for (uint64_t used = pid_map.bitmap[word]; used != 0; used &= used - 1) {
+      fn(pid_map.tasks[word * 64 + __builtin_ctzll(used)], arg);
+    }
+  }
+  spin_unlock(&pid_map.lock);
+}
+
+#ifdef CFG_RUN_PROC_PID_TEST
+PID_MAP_DEFINE(test_map, 128);
+
+static void test_map_reset() {
+  for (int i = 0; i < test_map.max / 64; i++) {
+    test_map.bitmap[i] = 0;
+  }
+  for (int i = 0; i < test_map.max; i++) {
+    test_map.tasks[i] = NULL;
+  }
+  test_map.last = -1;
+  test_map.nr_used = 0;
+}
+
+bool test_pid_alloc_lookup() {
+  struct task_struct *a = (struct task_struct *)0x1000;
+  struct task_struct *b = (struct task_struct *)0x2000;
+  test_map_reset();
+  assert(pid_map_alloc(&test_map, a) == 0);
+  assert(pid_map_alloc(&test_map, b) == 1);
+  assert(pid_map_lookup(&test_map, 0) == a);
+  assert(pid_map_lookup(&test_map, 1) == b);
+  assert(pid_map_lookup(&test_map, 2) == NULL);
+  assert(pid_map_lookup(&test_map, -1) == NULL);
+  assert(pid_map_lookup(&test_map, 128) == NULL);
+  pid_map_free(&test_map, 0);
+  assert(pid_map_lookup(&test_map, 0) == NULL);
+  return true;
+}
+
+bool test_pid_reuse() {
+  struct task_struct *t = (struct task_struct *)0x1000;
+  test_map_reset();
+  // Freed PIDs are not reused until wrapping around
+  assert(pid_map_alloc(&test_map, t) == 0);
+  pid_map_free(&test_map, 0);
+  assert(pid_map_alloc(&test_map, t) == 1);
+  for (int pid = 2; pid < 128; pid++) {
+    assert(pid_map_alloc(&test_map, t) == pid);
+  }
+  assert(pid_map_alloc(&test_map, t) == 0);
+  // Exhausted
+  assert(pid_map_alloc(&test_map, t) == -1);
+  pid_map_free(&test_map, 70);
+  assert(pid_map_alloc(&test_map, t) == 70);
+  return true;
+}
+#endif
+
+void test_pid() {
+#ifdef CFG_RUN_PROC_PID_TEST
+  unittest(test_pid_alloc_lookup, "PROC", "PID - alloc/lookup");
+  unittest(test_pid_reuse, "PROC", "PID - bitmap reuse");
+#endif
+}
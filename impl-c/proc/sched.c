@@ -1,8 +1,17 @@
 #include "proc/sched.h"
+#include "proc/acct.h"
+#include "proc/fpsimd.h"
+#include "proc/kthread.h"
+#include "proc/smp.h"
+#include "proc/trace.h"
 #include "proc/task.h"
 
+#include "atomic.h"
+#include "fatal.h"
 #include "list.h"
 #include "mm.h"
+#include "spinlock.h"
+#include "timer.h"
 #include "uart.h"
 
 #include "config.h"
@@ -14,47 +23,278 @@ static const int _DO_LOG = 1;
 static const int _DO_LOG = 0;
 #endif
 
-// proc/sched.S
-void switch_to(struct task_struct *prev, struct task_struct *next);
+// proc/switch.S
+struct task_struct *switch_to(struct task_struct *prev,
+                              struct task_struct *next);
 
 static void kill_zombies();
 
-struct list_head run_queue;
-struct list_head exited;
+struct run_queue run_queues[SMP_NUM_CPUS];
+
+// Dead tasks waiting to be recycled by an idle task
+static struct list_head exited;
+static spinlock_t exited_lock;
+
+// SCHED_MIGRATION_COST_US in cntpct_el0 ticks
+static uint64_t migration_cost;
 
 void proc_init() {
-  new_tid = 0;
-  list_init(&run_queue);
+  for (int i = 0; i < SMP_NUM_CPUS; i++) {
+    spin_lock_init(&run_queues[i].lock, "runqueue");
+    list_init(&run_queues[i].list);
+    run_queues[i].nr_queued = 0;
+  }
   list_init(&exited);
+  spin_lock_init(&exited_lock, "exited");
+  migration_cost = timer_el0_get_freq() / 1000000 * SCHED_MIGRATION_COST_US;
+}
+
+static inline bool cpu_allowed(struct task_struct *task, int cpuid) {
+  return (task->cpus_allowed & (1 << cpuid)) != 0;
+}
+
+static inline bool is_queued(struct task_struct *task) {
+  return task->sched_entry->list.next != NULL;
+}
+
+static inline bool is_cache_hot(struct task_struct *task) {
+  return (timer_el0_get_cnt() - task->last_ran) < migration_cost;
+}
+
+// Must be called with rq->lock held
+static inline void rq_push(struct run_queue *rq, struct task_struct *task) {
+  list_push(&task->sched_entry->list, &rq->list);
+  rq->nr_queued++;
+}
+
+// Must be called with rq->lock held
+static inline void rq_remove(struct run_queue *rq, struct task_struct *task) {
+  list_del(&task->sched_entry->list);
+  rq->nr_queued--;
+}
+
+// Must be called with rq->lock held
+static inline struct task_struct *rq_pop(struct run_queue *rq) {
+  if (list_empty(&rq->list)) {
+    return NULL;
+  }
+  struct task_entry *entry = (struct task_entry *)rq->list.next;
+  rq_remove(rq, entry->task);
+  return entry->task;
+}
+
+// Choose the least loaded online core allowed by the task's affinity,
+// prefer the core it ran on last time for a warm cache.
+static int select_task_cpu(struct task_struct *task) {
+  int target = -1;
+  for (int cpuid = 0; cpuid < SMP_NUM_CPUS; cpuid++) {
+    if (!cpus[cpuid].online || !cpu_allowed(task, cpuid)) {
+      continue;
+    }
+    if (target == -1 ||
+        run_queues[cpuid].nr_queued < run_queues[target].nr_queued ||
+        (run_queues[cpuid].nr_queued == run_queues[target].nr_queued &&
+         cpuid == task->cpu)) {
+      target = cpuid;
+    }
+  }
+  return target == -1 ? smp_cpu_id() : target;
+}
+
+void sched_enqueue(struct task_struct *task) {
+  int cpuid = select_task_cpu(task);
+  struct run_queue *rq = &run_queues[cpuid];
+  spin_lock(&rq->lock);
+  task->cpu = cpuid;
+  rq_push(rq, task);
+  spin_unlock(&rq->lock);
+}
+
+int sched_set_affinity(struct task_struct *task, uint32_t mask) {
+  mask &= SCHED_CPUS_ALL;
+  if (mask == 0) {
+    return -1;
+  }
+  struct run_queue *rq;
+  bool requeue = false;
+  // The task might be stolen by another core before we get the lock
+  while (1) {
+    rq = &run_queues[task->cpu];
+    spin_lock(&rq->lock);
+    if (rq == &run_queues[task->cpu]) {
+      break;
+    }
+    spin_unlock(&rq->lock);
+  }
+  task->cpus_allowed = mask;
+  // A running task is migrated at its next schedule
+  if (is_queued(task) && !cpu_allowed(task, task->cpu)) {
+    rq_remove(rq, task);
+    requeue = true;
+  }
+  spin_unlock(&rq->lock);
+  if (requeue) {
+    sched_enqueue(task);
+  }
+  return 0;
+}
+
+/**
+ * @brief Steal a task from the busiest run queue for an idle core.
+ *  Start from the head of the victim queue (the task waiting the longest,
+ *  with the coldest cache). Cache-hot tasks are left to their core unless the
+ *  victim queue is long enough to justify the migration cost.
+ */
+static struct task_struct *steal_task(int this_cpu) {
+  int busiest = -1;
+  for (int cpuid = 0; cpuid < SMP_NUM_CPUS; cpuid++) {
+    if (cpuid == this_cpu || run_queues[cpuid].nr_queued == 0) {
+      continue;
+    }
+    if (busiest == -1 ||
+        run_queues[cpuid].nr_queued > run_queues[busiest].nr_queued) {
+      busiest = cpuid;
+    }
+  }
+  if (busiest == -1) {
+    return NULL;
+  }
+
+  struct run_queue *rq = &run_queues[busiest];
+  struct list_head *entry;
+  struct task_struct *task, *stolen = NULL;
+  spin_lock(&rq->lock);
+  bool allow_hot = rq->nr_queued > SCHED_STEAL_HOT_THRESHOLD;
+  for (entry = rq->list.next; entry != &rq->list; entry = entry->next) {
+    task = ((struct task_entry *)entry)->task;
+    if (task->on_cpu || !cpu_allowed(task, this_cpu)) {
+      continue;
+    }
+    if (!allow_hot && is_cache_hot(task)) {
+      continue;
+    }
+    rq_remove(rq, task);
+    stolen = task;
+    break;
+  }
+  spin_unlock(&rq->lock);
+
+  if (stolen != NULL) {
+    log_println("[schedule] cpu%d steal task %d from cpu%d", this_cpu,
+                stolen->id, busiest);
+  }
+  return stolen;
+}
+
+void sched_wakeup(struct task_struct *task) {
+  bool enqueue = false;
+  spin_lock(&task->lock);
+  if (task->status == TASK_STATUS_SLEEPING) {
+    task->status = TASK_STATUS_ALIVE;
+    trace_record(TRACE_WAKEUP, task->id, smp_cpu_id());
+    // Still switching out, would be requeued by schedule_tail
+    enqueue = !task->on_cpu;
+  }
+  spin_unlock(&task->lock);
+  if (enqueue) {
+    sched_enqueue(task);
+  }
+}
+
+void sched_reap(struct task_struct *task) {
+  spin_lock(&exited_lock);
+  list_push(&task->sched_entry->list, &exited);
+  spin_unlock(&exited_lock);
+}
+
+void schedule_tail(struct task_struct *prev) {
+  struct cpu_info *cpu = this_cpu();
+  struct run_queue *rq = &run_queues[cpu->id];
+  bool requeue;
+
+  // The context of prev is fully saved from here
+  if (prev == NULL || prev == cpu->idle) {
+    if (prev != NULL) {
+      prev->on_cpu = false;
+    }
+    spin_unlock(&rq->lock);
+    return;
+  }
+  prev->last_ran = timer_el0_get_cnt();
+
+  if (prev->status == TASK_STATUS_DEAD) {
+    spin_unlock(&rq->lock);
+    if (task_switched_out_dead(prev)) {
+      sched_reap(prev);
+    }
+    return;
+  }
+
+  // Decide before clearing on_cpu, once cleared prev could be picked by other
+  // cores. A task not allowed on this core anymore is not queued either.
+  // Sleeping tasks are requeued by sched_wakeup.
+  spin_lock(&prev->lock);
+  requeue = prev->status == TASK_STATUS_ALIVE && !is_queued(prev);
+  prev->on_cpu = false;
+  spin_unlock(&prev->lock);
+  spin_unlock(&rq->lock);
+  if (requeue) {
+    sched_enqueue(prev);
+  }
 }
 
 void task_schedule() {
+  struct cpu_info *cpu = this_cpu();
+  struct run_queue *rq = &run_queues[cpu->id];
   struct task_struct *cur = get_current();
-  struct task_struct *next;
+  struct task_struct *next, *prev, *stolen;
+  bool cur_runnable = (cur != cpu->idle) && (cur->status == TASK_STATUS_ALIVE);
 
-  struct task_entry *entry_next;
 #ifdef CFG_LOG_PROC_SCHED
   _dump_runq();
 #endif
-  if (!list_empty(&run_queue)) {
-    while (1) {
-      entry_next = (struct task_entry *)list_pop_front(&run_queue);
-      next = entry_next->task;
-      if (next->status == TASK_STATUS_ALIVE) {
-        list_push(&entry_next->list, &run_queue);
-        break;
-      } else {
-        list_push(&entry_next->list, &exited);
-      }
+  // Going idle, pull work from other cores first
+  if (!cur_runnable && rq->nr_queued == 0) {
+    if (NULL != (stolen = steal_task(cpu->id))) {
+      spin_lock(&rq->lock);
+      stolen->cpu = cpu->id;
+      rq_push(rq, stolen);
+      spin_unlock(&rq->lock);
     }
-    log_println("[schedule] switch thread %d->%d", cur->id, next->id);
-    switch_to(cur, next);
   }
+
+  spin_lock(&rq->lock);
+  // A task no longer allowed on this core is migrated in schedule_tail
+  cur_runnable = cur_runnable && cpu_allowed(cur, cpu->id);
+  if (cur_runnable) {
+    rq_push(rq, cur);
+  }
+  next = rq_pop(rq);
+  if (next == NULL) {
+    next = cpu->idle;
+  }
+  if (next == cur) {
+    spin_unlock(&rq->lock);
+    return;
+  }
+  log_println("[schedule] cpu%d switch thread %d->%d", cpu->id, cur->id,
+              next->id);
+  next->on_cpu = true;
+  next->cpu = cpu->id;
+  if (kstack_overflowed(cur)) {
+    uart_println("[schedule] kernel stack overflow, task:%d", cur->id);
+    FATAL("Kernel stack corrupted");
+  }
+  fpsimd_switch_out(cur);
+  acct_switch(cur, next, cur->status != TASK_STATUS_ALIVE);
+  trace_record(TRACE_SWITCH, cur->id, next->id);
+  prev = switch_to(cur, next);
+  schedule_tail(prev);
 }
 
 void idle() {
   while (1) {
-    uart_println("idle scheduling...");
+    uart_println("idle scheduling... (cpu%d)", smp_cpu_id());
     _wait();
     task_schedule();
     kill_zombies();
@@ -64,25 +304,33 @@ void idle() {
 void kill_zombies() {
   struct list_head *entry;
   struct task_struct *task;
-  while (!list_empty(&exited)) {
+  while (1) {
+    spin_lock(&exited_lock);
+    if (list_empty(&exited)) {
+      spin_unlock(&exited_lock);
+      break;
+    }
     entry = list_pop(&exited);
+    spin_unlock(&exited_lock);
+
     task = ((struct task_entry *)entry)->task;
     log_println("recycle space for task:%d", task->id);
-    list_del(entry);
-    kfree(entry);
     task_free(task);
   }
 }
 
 void _dump_runq() {
-  struct list_head *list_head = &run_queue;
+  struct list_head *list_head;
   struct list_head *entry;
-  uart_printf("%s%s", LOG_DIM_START, "[schedule] Runqueue");
-  int i = 0;
-  for (entry = list_head->next; entry != list_head; entry = entry->next) {
-    struct task_struct *task = ((struct task_entry *)entry)->task;
-    uart_printf("->[%d, %x]", task->id, task);
-    i++;
-  }
-  uart_println("%s", LOG_DIM_END);
-}
\ No newline at end of file
+  for (int cpuid = 0; cpuid < SMP_NUM_CPUS; cpuid++) {
+    list_head = &run_queues[cpuid].list;
+    spin_lock(&run_queues[cpuid].lock);
+    uart_printf("%s[schedule] Runqueue(cpu%d)", LOG_DIM_START, cpuid);
+    for (entry = list_head->next; entry != list_head; entry = entry->next) {
+      struct task_struct *task = ((struct task_entry *)entry)->task;
+      uart_printf("->[%d, %x]", task->id, task);
+    }
+    uart_println("%s", LOG_DIM_END);
+    spin_unlock(&run_queues[cpuid].lock);
+  }
+}
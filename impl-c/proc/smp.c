@@ -0,0 +1,67 @@
+#include "proc/smp.h"
+#include "proc/sched.h"
+#include "proc/task.h"
+
+#include "uart.h"
+
+#include "config.h"
+#include "log.h"
+
+#include <stdint.h>
+
+#ifdef CFG_LOG_PROC_SMP
+static const int _DO_LOG = 1;
+#else
+static const int _DO_LOG = 0;
+#endif
+
+// Number of polling rounds before giving up on a core
+#define SMP_BOOT_TIMEOUT (1 << 24)
+
+struct cpu_info cpus[SMP_NUM_CPUS];
+
+// kernel/entry.S
+extern void _secondary_start();
+
+static void cpu_setup(int cpuid) {
+  struct cpu_info *cpu = &cpus[cpuid];
+  cpu->id = cpuid;
+  cpu->idle = task_create_idle();
+  set_current(cpu->idle);
+}
+
+static bool release_cpu(int cpuid) {
+  volatile uint64_t *spin_table = (volatile uint64_t *)SMP_SPIN_TABLE_BASE;
+  spin_table[cpuid] = (uint64_t)_secondary_start;
+  asm volatile("dsb sy \n"
+               "sev    \n" ::
+                   : "memory");
+
+  for (int i = 0; i < SMP_BOOT_TIMEOUT; i++) {
+    if (cpus[cpuid].online) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void smp_init() {
+  // The boot core becomes the idle task of cpu0
+  cpu_setup(0);
+  cpus[0].online = true;
+
+  for (int cpuid = 1; cpuid < SMP_NUM_CPUS; cpuid++) {
+    if (release_cpu(cpuid)) {
+      log_println("[smp] cpu%d online", cpuid);
+    } else {
+      uart_println("[smp] cpu%d failed to come online", cpuid);
+    }
+  }
+}
+
+void smp_secondary_main(int cpuid) {
+  cpu_setup(cpuid);
+  cpus[cpuid].online = true;
+  log_println("[smp] cpu%d joins the scheduler", cpuid);
+  idle();
+}
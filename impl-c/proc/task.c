@@ -2,13 +2,20 @@
 #include "proc.h"
 #include "proc/argv.h"
 #include "proc/exec.h"
+#include "proc/fpsimd.h"
+#include "proc/kthread.h"
+#include "proc/pid.h"
 #include "proc/sched.h"
+#include "proc/smp.h"
+#include "proc/trace.h"
 
 #include "bool.h"
 #include "fs/vfs.h"
 #include "list.h"
 #include "mm.h"
 #include "mm/frame.h"
+#include "mm/uaccess.h"
+#include "spinlock.h"
 #include "string.h"
 #include "syscall.h"
 #include "timer.h"
@@ -30,56 +37,117 @@ static void foo();
 extern void fork_child_eret();
 static inline void close_fd(struct task_struct *task, int fd);
 
-uint32_t new_tid = 0;
+extern void task_entry();
 
-struct task_struct *task_create(void *func) {
-  struct task_struct *t;
-  t = (struct task_struct *)kalloc(sizeof(struct task_struct));
-  if (t == NULL) {
-    log_println("[task] oops cannot allocate thread");
-    return NULL;
-  }
-
-  t->kernel_stack = (uintptr_t)kalloc(FRAME_SIZE);
-
-  // Normal task is a kernel function, which has already been loaded to memory
+static void task_init(struct task_struct *t) {
   t->code = NULL;
-  t->code_size = 0;
-  t->cpu_context.fp = t->kernel_stack + FRAME_SIZE;
-  t->cpu_context.lr = (uint64_t)func;
-  t->cpu_context.sp = t->kernel_stack + FRAME_SIZE;
   t->status = TASK_STATUS_ALIVE;
-  t->id = new_tid++;
+  t->exit_code = 0;
+  t->joinable = false;
+  t->joiner = NULL;
+  t->on_cpu = false;
+  spin_lock_init(&t->lock, "task");
+
+  t->parent = NULL;
+  list_init(&t->children);
+  t->sibling.next = NULL;
+  t->sibling.prev = NULL;
+
+  t->cpu = smp_cpu_id();
+  t->cpus_allowed = SCHED_CPUS_ALL;
+  t->last_ran = 0;
+  t->sched_entry = (struct task_entry *)kalloc(sizeof(struct task_entry));
+  t->sched_entry->task = t;
+  t->sched_entry->list.next = NULL;
+  t->sched_entry->list.prev = NULL;
+  acct_task_init(t);
+
+  t->fpsimd = NULL;
+  t->fpsimd_cpu = -1;
 
   t->fd_size = 0;
   for (int i = 0; i < TASK_MX_NUM_FD; i++) {
     t->fd[i] = NULL;
   }
+  t->cwd = NULL;
+  strcpy(t->cwd_path, "/");
 
   // A task would only bind to a user thread if called with exec_user
   t->user_stack = (uintptr_t)(NULL);
   t->user_sp = (uintptr_t)(NULL);
 
-  struct task_entry *entry =
-      (struct task_entry *)kalloc(sizeof(struct task_entry));
-  entry->task = t;
-  list_push(&entry->list, &run_queue);
-  // uart_println("entry created: %x %x", entry->task, entry->list);
+  // Visible through pid_lookup from here
+  t->id = pid_alloc(t);
+}
+
+struct task_struct *task_alloc_stack(void *func, int stack_order) {
+  struct task_struct *t;
+  uintptr_t kernel_stack = kstack_alloc(stack_order);
+  if (kernel_stack == (uintptr_t)NULL) {
+    log_println("[task] oops cannot allocate kernel stack");
+    return NULL;
+  }
+  t = (struct task_struct *)kalloc(sizeof(struct task_struct));
+  if (t == NULL) {
+    log_println("[task] oops cannot allocate thread");
+    kstack_free(kernel_stack, stack_order);
+    return NULL;
+  }
+  task_init(t);
+  if (t->id == -1) {
+    log_println("[task] oops running out of PIDs");
+    kfree(t->sched_entry);
+    kfree(t);
+    kstack_free(kernel_stack, stack_order);
+    return NULL;
+  }
+
+  t->kernel_stack = kernel_stack;
+  t->stack_order = stack_order;
+
+  // Normal task is a kernel function, which has already been loaded to memory
+  // The first switch_to would return to `task_entry`, which then calls `func`
+  t->cpu_context.fp = t->kernel_stack + kstack_size(stack_order);
+  t->cpu_context.lr = (uint64_t)task_entry;
+  t->cpu_context.x19 = (uint64_t)func;
+  t->cpu_context.x20 = 0;
+  t->cpu_context.sp = t->kernel_stack + kstack_size(stack_order);
 
   log_println("task created: id:%d struct:%x func:%x", t->id, t,
-              t->cpu_context.lr);
+              t->cpu_context.x19);
   return t;
 }
 
-void task_free(struct task_struct *task) {
-  // TODO: manage parent code free and child code free
-  // if (task->code) {
-  //   kfree(task->code);
-  // }
+struct task_struct *task_alloc(void *func) { return task_alloc_stack(func, 0); }
+
+struct task_struct *task_create(void *func) {
+  struct task_struct *t = task_alloc(func);
+  if (t != NULL) {
+    sched_enqueue(t);
+  }
+  return t;
+}
+
+struct task_struct *task_create_idle() {
+  struct task_struct *t;
+  t = (struct task_struct *)kalloc(sizeof(struct task_struct));
+  task_init(t);
+  // Running on the boot stack of this core, which is never freed
+  t->kernel_stack = (uintptr_t)(NULL);
+  t->stack_order = 0;
+  t->on_cpu = true;
+  log_println("idle task created: id:%d cpu:%d", t->id, smp_cpu_id());
+  return t;
+}
+
+void task_release_user(struct task_struct *task) {
+  task_code_put(task->code);
+  task->code = NULL;
   if (task->user_stack) {
     kfree((void *)task->user_stack);
+    task->user_stack = (uintptr_t)NULL;
   }
-  kfree((void *)task->kernel_stack);
+  fpsimd_release(task);
 
   // Close all file descriptors
   for (int i = 0; i < TASK_MX_NUM_FD; i++) {
@@ -87,6 +155,13 @@ void task_free(struct task_struct *task) {
       close_fd(task, i);
     }
   }
+}
+
+void task_free(struct task_struct *task) {
+  task_release_user(task);
+  kstack_free(task->kernel_stack, task->stack_order);
+  kfree(task->sched_entry);
+  pid_free(task->id);
   kfree(task);
 }
 
@@ -96,8 +171,8 @@ int sys_getpid() {
 };
 
 // Overwrite current user task and kernel task
-int sys_exec(const char *name, char *const args[]) {
-  exec_user(name, args);
+int sys_exec(const char *name, char *const args[], char *const envp[]) {
+  exec_user(name, args, envp);
   // a scucess exec_user might never return
   return -1;
 }
@@ -105,10 +180,18 @@ int sys_exec(const char *name, char *const args[]) {
 int sys_open(const char *pathname, int flags) {
   struct task_struct *task = get_current();
   struct file *file;
+  char path[VFS_PATH_MAX];
+  long len = strncpy_from_user(path, pathname, VFS_PATH_MAX);
+  if (len < 0) {
+    return -EFAULT;
+  }
+  if (len == VFS_PATH_MAX) {
+    return -ENAMETOOLONG;
+  }
   if (task->fd_size >= TASK_MX_NUM_FD) {
     return SYS_OPEN_MX_FD_REACHED;
   }
-  if (NULL == (file = vfs_open(pathname, flags))) {
+  if (NULL == (file = vfs_open_at(task->cwd, path, flags))) {
     return SYS_OPEN_FILE_NOT_FOUND;
   }
   for (int i = 0; i < TASK_MX_NUM_FD; i++) {
@@ -139,39 +222,97 @@ void close_fd(struct task_struct *task, int fd) {
 
 int sys_close(int fd) {
   struct task_struct *task = get_current();
-  if ((fd < 0 || fd > TASK_MX_NUM_FD) || (task->fd[fd] == NULL)) {
+  if ((fd < 0 || fd >= TASK_MX_NUM_FD) || (task->fd[fd] == NULL)) {
     return -1;
   }
   close_fd(task, fd);
   return 0;
 }
 
+// User buffers are passed down as is once validated (see mm/uaccess.h)
 int sys_write(int fd, const void *buf, int count) {
   struct task_struct *task = get_current();
-  if ((fd < 0 || fd > TASK_MX_NUM_FD) || (task->fd[fd] == NULL)) {
+  if ((fd < 0 || fd >= TASK_MX_NUM_FD) || (task->fd[fd] == NULL)) {
     return -1;
   }
+  if (count < 0 || !access_ok(buf, count)) {
+    return -EFAULT;
+  }
   struct file *file = task->fd[fd];
   return file->f_ops->write(file, buf, count);
 }
 
 int sys_read(int fd, void *buf, int count) {
   struct task_struct *task = get_current();
-  if ((fd < 0 || fd > TASK_MX_NUM_FD) || (task->fd[fd] == NULL)) {
+  if ((fd < 0 || fd >= TASK_MX_NUM_FD) || (task->fd[fd] == NULL)) {
     return -1;
   }
+  if (count < 0 || !access_ok(buf, count)) {
+    return -EFAULT;
+  }
   struct file *file = task->fd[fd];
   return file->f_ops->read(file, buf, count);
 }
 
-// note: void exit();
-void sys_exit() { cur_task_exit(); }
+void task_copy_cwd(struct task_struct *child,
+                   const struct task_struct *parent) {
+  child->cwd = parent->cwd;
+  strcpy(child->cwd_path, parent->cwd_path);
+}
+
+int sys_chdir(const char *pathname) {
+  struct task_struct *task = get_current();
+  struct vnode *dir;
+  char path[VFS_PATH_MAX], cwd_path[VFS_PATH_MAX];
+  long len = strncpy_from_user(path, pathname, VFS_PATH_MAX);
+  if (len < 0) {
+    return -EFAULT;
+  }
+  if (len == VFS_PATH_MAX ||
+      vfs_path_join(cwd_path, task->cwd_path, path, VFS_PATH_MAX) < 0) {
+    return -ENAMETOOLONG;
+  }
+  if (NULL == (dir = vfs_find_vnode_at(task->cwd, path, false))) {
+    return -ENOENT;
+  }
+  if (!dir->is_dir) {
+    return -ENOTDIR;
+  }
+  task->cwd = dir;
+  strcpy(task->cwd_path, cwd_path);
+  log_println("[task] %d: chdir to `%s`", task->id, task->cwd_path);
+  return 0;
+}
+
+int sys_getcwd(char *buf, size_t size) {
+  struct task_struct *task = get_current();
+  size_t len = strlen(task->cwd_path) + 1;
+  if (size < len) {
+    return -ERANGE;
+  }
+  if (copy_to_user(buf, task->cwd_path, len) != 0) {
+    return -EFAULT;
+  }
+  return len;
+}
+
+// note: void exit(int status);
+void sys_exit(int status) { task_exit(status); }
 
-void cur_task_exit() {
-  // Mark current thread as exited, which would be picked up by the idle thread
+void cur_task_exit() { task_exit(0); }
+
+void task_exit(int exit_code) {
+  // Mark current thread as exited, which would be freed by its parent, the
+  // joiner of a kernel thread, or the idle thread if no one waits for it
   struct task_struct *task = get_current();
-  task->status = TASK_STATUS_DEAD;
-  log_println("[task] exit called: %d", task->id);
+  log_println("[task] exit called: %d, code:%d", task->id, exit_code);
+
+  // Only the kernel stack is still in use, give back the rest right away
+  task_release_user(task);
+
+  task->exit_code = exit_code;
+  trace_record(TRACE_EXIT, task->id, exit_code);
+  task_exit_notify(task);
   task_schedule();
 }
 
@@ -190,31 +331,30 @@ void task_start_user() {
   uart_println("enter user startup");
   char *name = "./argv_test.out";
   char *args[4] = {"./argv_test.out", "-o", "arg2", NULL};
+  char *envp[2] = {"HOME=/", NULL};
 
   // Launch a user program thread (in el0) with this kernel thread
   //
   // Eversince this point, exceptions under el0 would be trap
   // to the context of this kernel thread
   // (Since we would call `eret` under this kernel thread)
-  exec_user(name, args);
+  exec_user(name, args, envp);
 }
 
 void test_user_io() {
   char *name = "./file.out";
   char *args[4] = {"./file.out", NULL};
-  exec_user(name, args);
+  exec_user(name, args, NULL);
 }
 
 void test_tasks() {
-  proc_init();
-
-  struct task_struct *root_task;
-  root_task = task_create(idle);
-  asm volatile("msr tpidr_el1, %0\n" ::"r"((uint64_t)root_task));
-
   // create a task to bootup the very first user program
   // task_create(task_start_user);
   task_create(test_user_io);
+#ifdef CFG_RUN_PROC_KTHREAD_TEST
+  // Joining sleeps, run it from a task
+  task_create(test_kthread);
+#endif
 
   task_create(foo);
   // task_create(foo);
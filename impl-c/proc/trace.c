@@ -0,0 +1,99 @@
+#include "proc/trace.h"
+#include "proc/smp.h"
+
+#include "atomic.h"
+#include "exception.h"
+#include "timer.h"
+#include "uart.h"
+
+#include "config.h"
+
+#include <stdint.h>
+
+#ifdef CFG_TRACE
+
+struct trace_ring {
+  uint64_t head;        // total number of events recorded
+  volatile int writing; // the owning core is between the check and head++
+  struct trace_event events[TRACE_RING_SIZE];
+};
+
+static struct trace_ring trace_rings[SMP_NUM_CPUS];
+
+// Pause recording while dumping, also keeps dumps from running together
+static atomic_t trace_paused = ATOMIC_INIT(0);
+
+void trace_record(enum trace_type type, int pid, int64_t arg) {
+  // Nothing but this core writes to its ring, masking IRQ is enough
+  unsigned long flags = irq_save();
+  int cpuid = smp_cpu_id();
+  struct trace_ring *ring = &trace_rings[cpuid];
+  struct trace_event *e;
+
+  // Either the dumper sees `writing` and waits, or we see the pause
+  ring->writing = 1;
+  smp_mb();
+  if (atomic_read(&trace_paused)) {
+    ring->writing = 0;
+    irq_restore(flags);
+    return;
+  }
+  // Read `head` after the check, it could have been reset by the dumper
+  smp_mb();
+  e = &ring->events[ring->head & (TRACE_RING_SIZE - 1)];
+  e->ts = timer_el0_get_cnt();
+  e->type = type;
+  e->cpu = cpuid;
+  e->pid = pid;
+  e->arg = arg;
+  ring->head++;
+  smp_mb();
+  ring->writing = 0;
+  irq_restore(flags);
+}
+
+static void dump_hex(const void *data, int size) {
+  static const char digits[] = "0123456789abcdef";
+  const uint8_t *p = data;
+  for (int i = 0; i < size; i++) {
+    uart_send(digits[p[i] >> 4]);
+    uart_send(digits[p[i] & 0xf]);
+  }
+}
+
+void trace_dump() {
+  if (atomic_cmpxchg(&trace_paused, 0, 1) != 0) {
+    uart_println("[trace] dump in progress");
+    return;
+  }
+
+  // Header, then one record per line: "@T <hex>"
+  uart_println("@TRACE BEGIN freq=%d cpus=%d", (int)timer_el0_get_freq(),
+               SMP_NUM_CPUS);
+  for (int cpuid = 0; cpuid < SMP_NUM_CPUS; cpuid++) {
+    struct trace_ring *ring = &trace_rings[cpuid];
+    // Wait for a record started before the pause, no new one starts after
+    while (ring->writing) {
+      ;
+    }
+    smp_mb();
+    uint64_t start = ring->head > TRACE_RING_SIZE ? ring->head - TRACE_RING_SIZE
+                                                  : 0;
+    for (uint64_t i = start; i < ring->head; i++) {
+      uart_puts("@T ");
+      dump_hex(&ring->events[i & (TRACE_RING_SIZE - 1)],
+               sizeof(struct trace_event));
+      uart_puts("\n");
+    }
+    ring->head = 0;
+  }
+  uart_println("@TRACE END");
+  smp_mb();
+  atomic_set(&trace_paused, 0);
+}
+
+#else
+
+void trace_dump() { uart_println("[trace] enable CFG_TRACE to record events"); }
+
+#endif
@@ -0,0 +1,96 @@
+#include "proc/uio.h"
+#include "proc/task.h"
+
+#include "bool.h"
+#include "mm/uaccess.h"
+#include "syscall.h"
+
+#include "config.h"
+#include "log.h"
+
+#ifdef CFG_LOG_PROC_TASK
+static const int _DO_LOG = 1;
+#else
+static const int _DO_LOG = 0;
+#endif
+
+// Stop at the first short transfer, as the file has nothing more to give
+static int do_iov(int fd, const struct iovec *user_iov, int iovcnt,
+                  bool write) {
+  struct iovec iov[IOV_MAX];
+  int total = 0, ret;
+  if (iovcnt < 0 || iovcnt > IOV_MAX) {
+    return -1;
+  }
+  // Buffers themselves are checked by sys_read/sys_write
+  if (copy_from_user(iov, user_iov, sizeof(struct iovec) * iovcnt) != 0) {
+    return -EFAULT;
+  }
+  for (int i = 0; i < iovcnt; i++) {
+    if (iov[i].iov_len == 0) {
+      continue;
+    }
+    if (write) {
+      ret = sys_write(fd, iov[i].iov_base, iov[i].iov_len);
+    } else {
+      ret = sys_read(fd, iov[i].iov_base, iov[i].iov_len);
+    }
+    if (ret < 0) {
+      return total == 0 ? ret : total;
+    }
+    total += ret;
+    if ((size_t)ret < iov[i].iov_len) {
+      break;
+    }
+  }
+  return total;
+}
+
+int sys_readv(int fd, const struct iovec *iov, int iovcnt) {
+  return do_iov(fd, iov, iovcnt, false);
+}
+
+int sys_writev(int fd, const struct iovec *iov, int iovcnt) {
+  return do_iov(fd, iov, iovcnt, true);
+}
+
+static int64_t io_run(const struct io_sqe *sqe) {
+  switch (sqe->opcode) {
+  case IO_OP_NOP:
+    return 0;
+  case IO_OP_OPEN:
+    return sys_open((const char *)sqe->addr, sqe->flags);
+  case IO_OP_CLOSE:
+    return sys_close(sqe->fd);
+  case IO_OP_READ:
+    return sys_read(sqe->fd, (void *)sqe->addr, sqe->len);
+  case IO_OP_WRITE:
+    return sys_write(sqe->fd, (const void *)sqe->addr, sqe->len);
+  case IO_OP_READV:
+    return sys_readv(sqe->fd, (const struct iovec *)sqe->addr, sqe->len);
+  case IO_OP_WRITEV:
+    return sys_writev(sqe->fd, (const struct iovec *)sqe->addr, sqe->len);
+  default:
+    return -ENOSYS;
+  }
+}
+
+int sys_io_submit(struct io_ring *ring) {
+  if (!access_ok(ring, sizeof(struct io_ring))) {
+    return -EFAULT;
+  }
+  uint32_t head = ring->sq_head, tail = ring->sq_tail;
+  uint32_t cq_tail = ring->cq_tail;
+  int consumed = 0;
+  while (head != tail && cq_tail - ring->cq_head < IO_RING_ENTRIES) {
+    const struct io_sqe *sqe = &ring->sq[head & (IO_RING_ENTRIES - 1)];
+    struct io_cqe *cqe = &ring->cq[cq_tail & (IO_RING_ENTRIES - 1)];
+    cqe->user_data = sqe->user_data;
+    cqe->res = io_run(sqe);
+    head++, cq_tail++, consumed++;
+  }
+  ring->sq_head = head;
+  ring->cq_tail = cq_tail;
+  log_println("[uio] io_submit: %d entries", consumed);
+  return consumed;
+}
@@ -0,0 +1,178 @@
+#include "proc/acct.h"
+#include "proc/pid.h"
+#include "proc/sched.h"
+#include "proc/task.h"
+
+#include "atomic.h"
+#include "errno.h"
+#include "list.h"
+#include "mm/uaccess.h"
+#include "spinlock.h"
+#include "syscall.h"
+
+#include "config.h"
+#include "log.h"
+
+#ifdef CFG_LOG_PROC_TASK
+static const int _DO_LOG = 1;
+#else
+static const int _DO_LOG = 0;
+#endif
+
+// Protect parent/children/sibling of all tasks, and the moment a dead task
+// is handed over to whoever frees it
+static spinlock_t proc_lock = SPINLOCK_INIT("proc_tree");
+
+#define sibling_task(entry) list_entry(entry, struct task_struct, sibling)
+
+void task_add_child(struct task_struct *parent, struct task_struct *child) {
+  spin_lock(&proc_lock);
+  child->parent = parent;
+  list_push(&child->sibling, &parent->children);
+  spin_unlock(&proc_lock);
+}
+
+// Must be called with proc_lock held
+static void hand_to_idle(struct task_struct *zombie) {
+  zombie->parent = NULL;
+  list_del(&zombie->sibling);
+  // Still switching out, task_switched_out_dead would hand it over
+  if (!zombie->on_cpu) {
+    sched_reap(zombie);
+  }
+}
+
+void task_exit_notify(struct task_struct *task) {
+  struct list_head *entry, *next;
+  struct task_struct *child;
+  spin_lock(&proc_lock);
+
+  // Orphans are no longer waited, zombies among them are freed right away
+  for (entry = task->children.next; entry != &task->children; entry = next) {
+    next = entry->next;
+    child = sibling_task(entry);
+    if (child->status == TASK_STATUS_DEAD) {
+      hand_to_idle(child);
+    } else {
+      child->parent = NULL;
+      list_del(&child->sibling);
+    }
+  }
+
+  task->status = TASK_STATUS_DEAD;
+  if (task->parent != NULL) {
+    sched_wakeup(task->parent);
+  }
+  if (task->joiner != NULL) {
+    sched_wakeup(task->joiner);
+  }
+  spin_unlock(&proc_lock);
+}
+
+bool task_switched_out_dead(struct task_struct *task) {
+  bool orphan;
+  spin_lock(&proc_lock);
+  orphan = (task->parent == NULL) && !task->joinable;
+  smp_mb();
+  // The parent (or joiner) could free the task from here
+  task->on_cpu = false;
+  spin_unlock(&proc_lock);
+  return orphan;
+}
+
+int task_waitpid(int pid, int *status) {
+  struct task_struct *cur = get_current();
+  struct task_struct *child, *zombie;
+  struct list_head *entry;
+  bool found;
+
+  while (1) {
+    found = false;
+    zombie = NULL;
+    spin_lock(&proc_lock);
+    if (pid != -1) {
+      child = pid_lookup(pid);
+      if (child != NULL && child->parent == cur) {
+        found = true;
+        if (child->status == TASK_STATUS_DEAD) {
+          zombie = child;
+          list_del(&zombie->sibling);
+        }
+      }
+    } else {
+      for (entry = cur->children.next; entry != &cur->children;
+           entry = entry->next) {
+        found = true;
+        child = sibling_task(entry);
+        if (child->status == TASK_STATUS_DEAD) {
+          zombie = child;
+          list_del(&zombie->sibling);
+          break;
+        }
+      }
+    }
+    if (!found) {
+      spin_unlock(&proc_lock);
+      return -1;
+    }
+    if (zombie != NULL) {
+      spin_unlock(&proc_lock);
+      break;
+    }
+    // Sleep until a child exits, woken up by task_exit_notify
+    spin_lock(&cur->lock);
+    cur->status = TASK_STATUS_SLEEPING;
+    spin_unlock(&cur->lock);
+    spin_unlock(&proc_lock);
+    task_schedule();
+  }
+
+  // The zombie might still be switching out on another core
+  while (zombie->on_cpu) {
+    ;
+  }
+  smp_mb();
+  pid = zombie->id;
+  if (status != NULL &&
+      copy_to_user(status, &zombie->exit_code, sizeof(int)) != 0) {
+    // Left as a zombie for the next wait
+    spin_lock(&proc_lock);
+    list_push(&zombie->sibling, &cur->children);
+    spin_unlock(&proc_lock);
+    return -EFAULT;
+  }
+  acct_reap(cur, zombie);
+  log_println("[wait] task %d reaps child %d, status:%d", cur->id, pid,
+              zombie->exit_code);
+  task_free(zombie);
+  return pid;
+}
+
+int task_join(struct task_struct *thread) {
+  struct task_struct *cur = get_current();
+  spin_lock(&proc_lock);
+  if (thread->joiner != NULL) {
+    spin_unlock(&proc_lock);
+    return -1;
+  }
+  thread->joiner = cur;
+  while (thread->status != TASK_STATUS_DEAD) {
+    // Sleep until the thread exits, woken up by task_exit_notify
+    spin_lock(&cur->lock);
+    cur->status = TASK_STATUS_SLEEPING;
+    spin_unlock(&cur->lock);
+    spin_unlock(&proc_lock);
+    task_schedule();
+    spin_lock(&proc_lock);
+  }
+  spin_unlock(&proc_lock);
+
+  // The thread might still be switching out on another core
+  while (thread->on_cpu) {
+    ;
+  }
+  smp_mb();
+  return 0;
+}
+
+int sys_waitpid(int pid, int *status) { return task_waitpid(pid, status); }
@@ -1,4 +1,6 @@
+#include "proc/acct.h"
 #include "proc/exec.h"
+#include "proc/trace.h"
 #include "shell/cmd.h"
 
 #include "bool.h"
@@ -6,6 +8,7 @@
 #include "dev/cpio.h"
 #include "log.h"
 #include "string.h"
+#include "syscall.h"
 #include "test.h"
 #include "timer.h"
 #include "uart.h"
@@ -28,6 +31,9 @@ static void cmdLs();
 static void cmdHelp();
 // static void cmdLoadUser();
 static void cmdReboot();
+static void cmdTrace();
+static void cmdTop();
+static void cmdSyscallStats();
 
 Cmd cmdList[] = {
     {.name = "hello", .help = "Greeting", .func = cmdHello},
@@ -37,6 +43,11 @@ Cmd cmdList[] = {
     //  .func = cmdLoadUser},
     {.name = "help", .help = "Show avalible commands", .func = cmdHelp},
     {.name = "reboot", .help = "Reboot device", .func = cmdReboot},
+    {.name = "trace", .help = "Dump scheduler trace", .func = cmdTrace},
+    {.name = "top", .help = "Show CPU usage of tasks", .func = cmdTop},
+    {.name = "syscall_stats",
+     .help = "Show syscall latency histograms",
+     .func = cmdSyscallStats},
 };
 
 Cmd *getCmd(char *name) {
@@ -80,6 +91,12 @@ void cmdReboot() {
   *PM_WDOG = PM_PASSWORD | 100; // reboot after 100 watchdog ticks
 }
 
+void cmdTrace() { trace_dump(); }
+
+void cmdTop() { acct_show_top(); }
+
+void cmdSyscallStats() { syscall_show_stats(); }
+
 // TODO: make this work with scheduling
 // void cmdLoadUser() {
 //   log_println("load user program");
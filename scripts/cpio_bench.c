@@ -0,0 +1,109 @@
+// Copyright (C) 2021 IanChen (ianchen-tw@github)
+/**
+ * Host benchmark of newc header parsing in impl-c/dev/cpio.c: the scalar
+ * `_parseHexStr` (one char at a time) against the SWAR
+ * `cpioParseHeaderFields`, both decoding all 13 fields of every header.
+ *
+ * usage: make bench-cpio
+ *    or: ./scripts/cpio_bench [archive] [rounds]
+ */
+#include "dev/cpio.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Kernel symbols referenced by dev/cpio.c
+void uart_println(char *format, ...) {}
+void uart_printf(char *format, ...) {}
+void *kalloc(int size) { return malloc(size); }
+void kfree(void *addr) { free(addr); }
+
+int64_t _parseHexStr(const char *buf, int len);
+
+#define ALIGN4(n) (((n) + 3) & ~(uintptr_t)3)
+
+// @retval number of headers parsed before the trailer, -1 on a broken header
+static inline int walk(char *archive, int swar, uint64_t *sum) {
+  CpioNewcHeader *header = (CpioNewcHeader *)archive;
+  uint32_t fields[CPIO_NEWC_FIELDS];
+  const char *name;
+  int n;
+  for (n = 0;; n++) {
+    if (swar) {
+      if (cpioParseHeaderFields(header, fields) != 0) {
+        return -1;
+      }
+    } else {
+      const char *field = header->ino;
+      for (int i = 0; i < CPIO_NEWC_FIELDS; i++, field += 8) {
+        int64_t val = _parseHexStr(field, 8);
+        if (val == -1) {
+          return -1;
+        }
+        fields[i] = (uint32_t)val;
+      }
+    }
+    for (int i = 0; i < CPIO_NEWC_FIELDS; i++) {
+      *sum += fields[i];
+    }
+    name = (const char *)(header + 1);
+    if (__builtin_strcmp(name, CPIO_FOOTER_MAGIC) == 0) {
+      return n;
+    }
+    uintptr_t data = ALIGN4((uintptr_t)name + fields[CPIO_FIELD_NAMESIZE]);
+    header = (CpioNewcHeader *)ALIGN4(data + fields[CPIO_FIELD_FILESIZE]);
+  }
+}
+
+static double now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static double bench(char *archive, int swar, long rounds, uint64_t *sum) {
+  double start = now_ns();
+  for (long r = 0; r < rounds; r++) {
+    walk(archive, swar, sum);
+  }
+  return now_ns() - start;
+}
+
+int main(int argc, char *argv[]) {
+  const char *path = argc > 1 ? argv[1] : "res/initramfs.cpio";
+  long rounds = argc > 2 ? atol(argv[2]) : 100000;
+  uint64_t sum_scalar = 0, sum_swar = 0;
+  FILE *f = fopen(path, "rb");
+  if (f == NULL || rounds <= 0) {
+    fprintf(stderr, "usage: %s [archive] [rounds]\n", argv[0]);
+    return 1;
+  }
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  rewind(f);
+  // Loaded at an aligned address, as the kernel gets it
+  char *archive = aligned_alloc(8, ALIGN4(size) + 8);
+  if (fread(archive, 1, size, f) != (size_t)size) {
+    fprintf(stderr, "could not read %s\n", path);
+    return 1;
+  }
+  fclose(f);
+
+  int headers = walk(archive, 0, &sum_scalar);
+  if (headers < 0 || walk(archive, 1, &sum_swar) != headers ||
+      sum_scalar != sum_swar) {
+    fprintf(stderr, "%s: parsers disagree or archive is broken\n", path);
+    return 1;
+  }
+  headers++; // the trailer is parsed as well
+
+  double t_scalar = bench(archive, 0, rounds, &sum_scalar);
+  double t_swar = bench(archive, 1, rounds, &sum_swar);
+  printf("%s: %d headers x %ld rounds\n", path, headers, rounds);
+  printf("  scalar: %8.2f ns/header\n", t_scalar / rounds / headers);
+  printf("  swar:   %8.2f ns/header (%.2fx)\n", t_swar / rounds / headers,
+         t_scalar / t_swar);
+  free(archive);
+  return 0;
+}
@@ -0,0 +1,188 @@
+# Copyright (C) 2021 IanChen (ianchen-tw@github)
+"""Decode a scheduler trace dumped by the kernel (`trace` shell command)
+into Chrome trace / Perfetto JSON (open with chrome://tracing or ui.perfetto.dev)
+
+usage: python scripts/trace_decode.py uart.log -o trace.json
+"""
+
+import argparse
+import json
+import struct
+import sys
+from dataclasses import dataclass
+from typing import Dict, Iterable, List, Optional
+
+from rich.console import Console
+
+# Keep in sync with impl-c/include/proc/trace.h
+TRACE_SWITCH = 1
+TRACE_WAKEUP = 2
+TRACE_FORK = 3
+TRACE_EXIT = 4
+TRACE_SYSCALL_ENTER = 5
+TRACE_SYSCALL_EXIT = 6
+
+# struct trace_event: ts(u64) type(u16) cpu(u16) pid(i32) arg(i64)
+EVENT_FMT = "<QHHiq"
+EVENT_SIZE = struct.calcsize(EVENT_FMT)
+
+console = Console(stderr=True)
+
+
+@dataclass
+class TypedArgs:
+    log: str
+    output: Optional[str]
+
+    @classmethod
+    def parse(cls):
+        p = argparse.ArgumentParser(description="Decode kernel scheduler trace")
+        p.add_argument("log", help="captured uart output containing a trace dump")
+        p.add_argument("-o", dest="output", help="output json (default: stdout)")
+        arg = p.parse_args()
+        return cls(log=arg.log, output=arg.output)
+
+
+@dataclass
+class Event:
+    ts: int
+    type: int
+    cpu: int
+    pid: int
+    arg: int
+
+
+@dataclass
+class Dump:
+    freq: int
+    cpus: int
+    events: List[Event]
+
+
+def parse_dump(lines: Iterable[str]) -> Optional[Dump]:
+    """Parse the last `@TRACE BEGIN` ... `@TRACE END` block"""
+    dump: Optional[Dump] = None
+    cur: Optional[Dump] = None
+    for line in lines:
+        line = line.strip()
+        if line.startswith("@TRACE BEGIN"):
+            fields = dict(f.split("=") for f in line.split()[2:])
+            cur = Dump(freq=int(fields["freq"]), cpus=int(fields["cpus"]), events=[])
+        elif line.startswith("@TRACE END") and cur is not None:
+            dump, cur = cur, None
+        elif line.startswith("@T ") and cur is not None:
+            raw = bytes.fromhex(line[3:])
+            if len(raw) != EVENT_SIZE:
+                console.print(f"[yellow]skip malformed record: {line}")
+                continue
+            cur.events.append(Event(*struct.unpack(EVENT_FMT, raw)))
+    return dump
+
+
+def to_chrome_trace(dump: Dump) -> Dict:
+    """Each core is a thread of a single `cpus` process:
+    running tasks are slices, syscalls nested slices, other events instants
+    """
+    events = sorted(dump.events, key=lambda e: e.ts)
+    base = events[0].ts if events else 0
+
+    def us(ts: int) -> float:
+        return (ts - base) * 1e6 / dump.freq
+
+    out: List[Dict] = [
+        {"ph": "M", "name": "process_name", "pid": 0, "args": {"name": "cpus"}}
+    ]
+    for cpu in range(dump.cpus):
+        out.append(
+            {
+                "ph": "M",
+                "name": "thread_name",
+                "pid": 0,
+                "tid": cpu,
+                "args": {"name": f"cpu{cpu}"},
+            }
+        )
+
+    # Task running on each core and when it's switched in
+    running: Dict[int, Event] = {}
+    for e in events:
+        common = {"pid": 0, "tid": e.cpu, "ts": us(e.ts)}
+        if e.type == TRACE_SWITCH:
+            start = running.get(e.cpu)
+            if start is not None:
+                out.append(
+                    {
+                        **common,
+                        "ph": "X",
+                        "name": f"task {e.pid}",
+                        "ts": us(start.ts),
+                        "dur": us(e.ts) - us(start.ts),
+                    }
+                )
+            running[e.cpu] = Event(e.ts, e.type, e.cpu, e.arg, 0)
+        elif e.type == TRACE_SYSCALL_ENTER:
+            out.append({**common, "ph": "B", "name": f"syscall {e.arg}"})
+        elif e.type == TRACE_SYSCALL_EXIT:
+            out.append({**common, "ph": "E", "args": {"ret": e.arg}})
+        elif e.type == TRACE_WAKEUP:
+            out.append(
+                {
+                    **common,
+                    "ph": "i",
+                    "s": "t",
+                    "name": f"wakeup {e.pid}",
+                    "args": {"waker_cpu": e.arg},
+                }
+            )
+        elif e.type == TRACE_FORK:
+            out.append(
+                {**common, "ph": "i", "s": "t", "name": f"fork {e.pid}->{e.arg}"}
+            )
+        elif e.type == TRACE_EXIT:
+            out.append(
+                {
+                    **common,
+                    "ph": "i",
+                    "s": "t",
+                    "name": f"exit {e.pid}",
+                    "args": {"code": e.arg},
+                }
+            )
+        else:
+            console.print(f"[yellow]unknown event type: {e.type}")
+
+    # Tasks still running at the end of the dump
+    end = events[-1].ts if events else 0
+    for cpu, start in running.items():
+        out.append(
+            {
+                "ph": "X",
+                "pid": 0,
+                "tid": cpu,
+                "name": f"task {start.pid}",
+                "ts": us(start.ts),
+                "dur": us(end) - us(start.ts),
+            }
+        )
+    return {"traceEvents": out, "displayTimeUnit": "ns"}
+
+
+def main():
+    args = TypedArgs.parse()
+    with open(args.log, errors="replace") as f:
+        dump = parse_dump(f)
+    if dump is None:
+        console.print("[red]no complete trace dump found")
+        sys.exit(1)
+    console.print(f"decoded {len(dump.events)} events ({dump.cpus} cpus)")
+
+    trace = to_chrome_trace(dump)
+    if args.output:
+        with open(args.output, "w") as f:
+            json.dump(trace, f)
+    else:
+        json.dump(trace, sys.stdout)
+
+
+if __name__ == "__main__":
+    main()
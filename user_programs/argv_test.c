@@ -1,15 +1,30 @@
 #include "lib.h"
 
-int main(int argc, char **argv) {
+int main(int argc, char **argv, char **envp) {
   int pid = getpid();
   printf("Argv Test, pid %d\n", pid);
   for (int i = 0; i < argc; ++i) {
     printf("  argv[%d] = %s\n", i, argv[i]);
   }
+  char **env = envp;
+  for (; *env != NULL; env++) {
+    printf("  env: %s\n", *env);
+  }
+  for (unsigned long *aux = (unsigned long *)(env + 1); aux[0] != AT_NULL;
+       aux += 2) {
+    printf("  auxv[%d] = %x\n", (int)aux[0], (int)aux[1]);
+  }
 
   char *fork_argv[2];
   fork_argv[0] = "./fork_test.out";
   fork_argv[1] = NULL;
-  exec("./fork_test.out", (const char **)fork_argv);
+  char *fork_envp[2];
+  fork_envp[0] = "PARENT=argv_test";
+  fork_envp[1] = NULL;
+  int status;
+  int child = spawnve("./fork_test.out", (const char **)fork_argv,
+                      (const char **)fork_envp);
+  waitpid(child, &status);
+  printf("pid: %d, spawned %d exited with status %d\n", pid, child, status);
   return 0;
-}
\ No newline at end of file
+}
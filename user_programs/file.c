@@ -1,13 +1,38 @@
 #include "lib.h"
 
+static void queue(struct io_ring *ring, uint32_t op, int fd, const void *addr,
+                  uint32_t len) {
+  struct io_sqe *sqe = &ring->sq[ring->sq_tail & (IO_RING_ENTRIES - 1)];
+  sqe->opcode = op;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t)addr;
+  sqe->len = len;
+  sqe->flags = 0;
+  sqe->user_data = ring->sq_tail;
+  ring->sq_tail++;
+}
+
 int main() {
   char buf[256];
   int a = open("hello", FILE_O_CREAT);
   int b = open("world", FILE_O_CREAT);
-  write(a, "Hello ", 6);
-  write(b, "World!", 6);
-  close(a);
-  close(b);
+
+  // Write and close both files with a single syscall
+  struct io_ring ring;
+  ring.sq_head = ring.sq_tail = ring.cq_head = ring.cq_tail = 0;
+  queue(&ring, IO_OP_WRITE, a, "Hello ", 6);
+  queue(&ring, IO_OP_WRITE, b, "World!", 6);
+  queue(&ring, IO_OP_CLOSE, a, NULL, 0);
+  queue(&ring, IO_OP_CLOSE, b, NULL, 0);
+  io_submit(&ring);
+  while (ring.cq_head != ring.cq_tail) {
+    struct io_cqe *cqe = &ring.cq[ring.cq_head & (IO_RING_ENTRIES - 1)];
+    if (cqe->res < 0) {
+      printf("io entry %d failed: %d\n", (int)cqe->user_data, (int)cqe->res);
+    }
+    ring.cq_head++;
+  }
+
   b = open("hello", 0);
   a = open("world", 0);
   int sz;
@@ -15,5 +40,30 @@ int main() {
   sz += read(a, buf + sz, 100);
   buf[sz] = '\0';
   printf("%s\n", buf); // should be Hello World!
+
+  // Scatter the same content into two buffers
+  char first[4], rest[16] = {0};
+  struct iovec iov[] = {
+      {.iov_base = first, .iov_len = sizeof(first) - 1},
+      {.iov_base = rest, .iov_len = sizeof(rest) - 1},
+  };
+  close(b);
+  b = open("hello", 0);
+  readv(b, iov, 2);
+  first[3] = '\0';
+  printf("readv: [%s][%s]\n", first, rest); // [Hel][lo ]
+  close(a);
+  close(b);
+
+  // Relative paths start from the working directory
+  chdir("folder/f2");
+  chdir("../");
+  getcwd(buf, sizeof(buf));
+  printf("cwd: %s\n", buf); // /folder
+  a = open("test.txt", 0);
+  sz = read(a, buf, 100);
+  buf[sz < 0 ? 0 : sz] = '\0';
+  printf("folder/test.txt: %s\n", buf);
+  close(a);
   return 0;
-}
\ No newline at end of file
+}
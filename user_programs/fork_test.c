@@ -16,5 +16,14 @@ int main(void) {
   } else {
     printf("parent here, pid %d, child %d\n", getpid(), ret);
   }
+  // Reap all children
+  int status, pid;
+  while ((pid = wait(&status)) != -1) {
+    printf("pid: %d, child %d exited with status %d\n", getpid(), pid, status);
+  }
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  printf("pid: %d, usr %dus, sys %dus, syscalls %d\n", getpid(),
+         (int)ru.utime_us, (int)ru.stime_us, (int)ru.nsyscalls);
   return 0;
 }
\ No newline at end of file
@@ -2,21 +2,92 @@
 
 #include "stddef.h"
 #include <stdarg.h>
+#include <stdint.h>
 
 #define FILE_O_CREAT (1 << 0)
 
+// Keep in sync with impl-c/include/proc/argv.h
+// auxv follows the NULL ending envp, as (type, value) pairs
+#define AT_NULL 0
+#define AT_PAGESZ 6
+#define AT_ENTRY 9
+#define AT_HWCAP 16
+
+#define RUSAGE_SELF 0
+#define RUSAGE_CHILDREN -1
+
+// Keep in sync with impl-c/include/proc/acct.h
+struct rusage {
+  unsigned long utime_us;
+  unsigned long stime_us;
+  unsigned long nvcsw;
+  unsigned long nivcsw;
+  unsigned long nsyscalls;
+};
+
+// Keep in sync with impl-c/include/proc/uio.h
+#define IOV_MAX 16
+#define IO_RING_ENTRIES 16
+
+struct iovec {
+  void *iov_base;
+  size_t iov_len;
+};
+
+#define IO_OP_NOP 0
+#define IO_OP_OPEN 1
+#define IO_OP_CLOSE 2
+#define IO_OP_READ 3
+#define IO_OP_WRITE 4
+#define IO_OP_READV 5
+#define IO_OP_WRITEV 6
+
+struct io_sqe {
+  uint32_t opcode;
+  int32_t fd;
+  uint64_t addr;
+  uint32_t len;
+  int32_t flags;
+  uint64_t user_data;
+};
+
+struct io_cqe {
+  uint64_t user_data;
+  int64_t res;
+};
+
+struct io_ring {
+  volatile uint32_t sq_head;
+  volatile uint32_t sq_tail;
+  volatile uint32_t cq_head;
+  volatile uint32_t cq_tail;
+  struct io_sqe sq[IO_RING_ENTRIES];
+  struct io_cqe cq[IO_RING_ENTRIES];
+};
+
 // == lib.s
 // syscalls for user programs
 int getpid();
 size_t uart_read(char buf[], size_t size);
 size_t uart_write(const char buf[], size_t size);
 int exec(const char *name, const char **args);
-void exit();
+int execve(const char *name, const char **args, const char **envp);
+int spawn(const char *name, const char **args);
+int spawnve(const char *name, const char **args, const char **envp);
+void exit(int status);
 int fork();
 int open(const char *pathname, int flags);
 int close(int fd);
 int write(int fd, const void *buf, int count);
 int read(int fd, void *buf, int count);
+int waitpid(int pid, int *status);
+int wait(int *status);
+int getrusage(int who, struct rusage *usage);
+int readv(int fd, const struct iovec *iov, int iovcnt);
+int writev(int fd, const struct iovec *iov, int iovcnt);
+int io_submit(struct io_ring *ring);
+int chdir(const char *path);
+int getcwd(char *buf, size_t size);
 
 // == stdio.c
 void printf(char *fmt, ...);